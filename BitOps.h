@@ -0,0 +1,36 @@
+//
+// @file: BitOps.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_BITOPS_H
+#define PJ4DEV_BITOPS_H
+
+#include <cstdint>
+
+namespace pj4dev {
+
+  // the index of the highest and of the lowest bit set in x, which is not 0
+  inline int highest_bit(std::uint64_t x) noexcept {
+  #if defined(__GNUC__)
+      return 63 - __builtin_clzll(x);
+  #else
+      auto n = 0;
+      while (x >>= 1) ++n;
+      return n;
+  #endif
+  }
+  inline int lowest_bit(std::uint64_t x) noexcept {
+  #if defined(__GNUC__)
+      return __builtin_ctzll(x);
+  #else
+      auto n = 0;
+      while (!(x & 1)) { x >>= 1; ++n; }
+      return n;
+  #endif
+  }
+
+}
+
+#endif // PJ4DEV_BITOPS_H
@@ -0,0 +1,667 @@
+//
+// @file: ConcurrentExpiringMap.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_CONCURRENTEXPIRINGMAP_H
+#define PJ4DEV_CONCURRENTEXPIRINGMAP_H
+
+#include "ExpiringMap.h"
+#include "ExpiryReaper.h"
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <thread>
+
+namespace pj4dev {
+
+  //
+  // Class: ConcurrentExpiringMap
+  // Usage: ConcurrentExpiringMap<K, V> emap(shards);
+  // ----------------------------------------------------------------
+  // This template provides a thread-safe expiring map. Keys are spread by hash
+  // over a power-of-two number of shards, and each shard is an ExpiringMap with
+  // its own lock and its own expiry index, so threads working on different
+  // shards never contend and expiry work stays local to the shard being
+  // written. size() and keys() visit the shards one at a time, so they are not
+  // an atomic snapshot of the whole map.
+  template<typename K, typename V, typename Expiry = HeapExpiry, typename Hash = std::hash<K>,
+           typename Clock = SteadyClock>
+  class ConcurrentExpiringMap {
+  public:
+      using handle = PinnedValue<V, std::unique_lock<std::mutex>>;
+
+      // shards == 0 picks four shards per hardware thread
+      explicit ConcurrentExpiringMap(size_t shards = 0);
+      ConcurrentExpiringMap(const ConcurrentExpiringMap&) = delete;
+      ConcurrentExpiringMap& operator=(const ConcurrentExpiringMap&) = delete;
+      ~ConcurrentExpiringMap();
+
+      //
+      // Member function: put
+      // Usage: emap.put(key, value, duration);
+      // ----------------------------------------------------------------
+      // This function inserts or overwrites a key with the duration for
+      // expiration (in milliseconds), locking only the key's shard.
+      void put(const K& key, const V& value, long ms);
+      void put(K&& key, V&& value, long ms);
+
+      //
+      // Member function: try_emplace
+      // Usage: emap.try_emplace(key, duration, args...);
+      // ----------------------------------------------------------------
+      // This function inserts a key with a value constructed from args unless
+      // a live one exists; see ExpiringMap::try_emplace. The value is
+      // constructed under the shard lock.
+      template<typename KK, typename... Args>
+      bool try_emplace(KK&& key, long ms, Args&&... args);
+
+      //
+      // Member function: insert_or_assign
+      // Usage: emap.insert_or_assign(key, value, duration);
+      // ----------------------------------------------------------------
+      // This function works like put() and forwards the key and the value; see
+      // ExpiringMap::insert_or_assign.
+      template<typename KK, typename M>
+      bool insert_or_assign(KK&& key, M&& value, long ms);
+
+      //
+      // Member function: put_batch
+      // Usage: emap.put_batch(entries.begin(), entries.end(), duration);
+      // ----------------------------------------------------------------
+      // This function puts a range of (key, value) pairs with one duration and
+      // one reading of the clock. The pairs are grouped by shard, so each
+      // shard involved is locked once, and purges once, for all of its keys;
+      // see ExpiringMap::put_batch.
+      template<typename It>
+      void put_batch(It first, It last, long ms);
+
+      //
+      // Member function: get
+      // Usage: emap.get(key);
+      // ----------------------------------------------------------------
+      // This function retrieves a value from the given key, or the default value
+      // if the key does not exist or has already expired.
+      V get(const K& key) const;
+
+      //
+      // Member function: get_batch
+      // Usage: emap.get_batch(keys.begin(), keys.end(), values.data());
+      // ----------------------------------------------------------------
+      // This function writes the value of each key in the range, or the
+      // default value, to the corresponding element of out, locking each
+      // shard involved once; see ExpiringMap::get_batch.
+      template<typename It>
+      void get_batch(It first, It last, V* out) const;
+
+      //
+      // Member function: lookup
+      // Usage: if (auto value = emap.lookup(key)) use(*value);
+      // ----------------------------------------------------------------
+      // This function returns a handle to the value of the given key that
+      // reads it in place, holding the key's shard locked until the handle is
+      // destroyed; the handle is empty if the key does not exist or has
+      // expired. Other threads using that shard wait meanwhile, so copy out
+      // what is needed and let the handle go.
+      handle lookup(const K& key) const;
+
+      //
+      // Member function: keys
+      // Usage: auto keys = emap.keys();
+      // ----------------------------------------------------------------
+      // This function returns the keys which are still valid in all shards,
+      // ordered by their expiration time.
+      std::vector<K> keys() const;
+
+      //
+      // Member function: for_each_live
+      // Usage: emap.for_each_live([](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with the key and the value of every live
+      // element, reading the time once and visiting the shards one at a time
+      // under their locks, so fn must not call back into the map. Like
+      // keys(), it is not a snapshot across shards.
+      template<typename F>
+      void for_each_live(F&& fn) const;
+
+      //
+      // Member function: left
+      // Usage: auto timeLeft = emap.left(key);
+      // ----------------------------------------------------------------
+      // This function returns the remaining time (in milliseconds) of the key.
+      long left(const K& key) const;
+
+      //
+      // Member function: next_expiry
+      // Usage: auto timeLeft = emap.next_expiry();
+      // ----------------------------------------------------------------
+      // This function returns the remaining time (in milliseconds) of the
+      // element that expires first in any shard, or -1 if no element is live.
+      long next_expiry() const;
+
+      //
+      // Member function: expiring_within
+      // Usage: emap.expiring_within(duration, [](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with each live element that expires within the
+      // given duration, soonest first, up to limit elements, and returns how
+      // many it visited; see ExpiringMap::expiring_within. Each shard
+      // contributes its soonest elements under its lock, and fn is called on
+      // copies once every lock is released, so it may use the map.
+      template<typename F>
+      size_t expiring_within(long ms, F&& fn, size_t limit = SIZE_MAX) const;
+
+      //
+      // Member function: touch
+      // Usage: emap.touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function resets the remaining time of a live key without touching
+      // its value, locking only the key's shard; see ExpiringMap::touch.
+      bool touch(const K& key, long ms);
+
+      //
+      // Member function: get_and_touch
+      // Usage: auto value = emap.get_and_touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function returns the value of a live key and resets its remaining
+      // time under one shard lock; see ExpiringMap::get_and_touch.
+      V get_and_touch(const K& key, long ms);
+
+      //
+      // Member function: erase
+      // Usage: emap.erase(key);
+      // ----------------------------------------------------------------
+      // This function deletes a key and its associated value.
+      void erase(const K& key);
+
+      //
+      // Member function: erase_batch
+      // Usage: auto n = emap.erase_batch(keys.begin(), keys.end());
+      // ----------------------------------------------------------------
+      // This function deletes every key in the range, locking each shard
+      // involved once, and returns how many of them were in the map.
+      template<typename It>
+      size_t erase_batch(It first, It last);
+
+      //
+      // Member function: clear
+      // Usage: emap.clear();
+      // ----------------------------------------------------------------
+      // This function removes all elements, one shard at a time.
+      void clear();
+
+      //
+      // Member function: size
+      // Usage: auto s = emap.size();
+      // ----------------------------------------------------------------
+      // This function returns the sum of the non-expired elements of every shard.
+      size_t size() const;
+
+      //
+      // Member function: expire
+      // Usage: auto n = emap.expire(budget);
+      // ----------------------------------------------------------------
+      // This function removes up to `budget` expired elements across the
+      // shards, locking one shard at a time, and returns how many were
+      // removed. Successive calls start from successive shards so that a
+      // small budget still reaches every shard.
+      size_t expire(size_t budget = expire_all);
+
+      //
+      // Member function: attach
+      // Usage: emap.attach(reaper);
+      // ----------------------------------------------------------------
+      // This function hands expiry over to a (possibly shared) ExpiryReaper:
+      // put() stops purging expired elements and the reaper drains them in
+      // bounded steps instead. The reaper must outlive the attachment.
+      void attach(ExpiryReaper& reaper);
+
+      //
+      // Member function: start_reaper
+      // Usage: emap.start_reaper(std::chrono::milliseconds(10), 1000);
+      // ----------------------------------------------------------------
+      // This function attaches the map to a reaper thread of its own.
+      void start_reaper(std::chrono::milliseconds interval, size_t budget);
+
+      //
+      // Member function: detach
+      // Usage: emap.detach();
+      // ----------------------------------------------------------------
+      // This function stops background expiry and lets put() purge again.
+      void detach();
+
+      //
+      // Member function: set_expiry_budget
+      // Usage: emap.set_expiry_budget(64);
+      // ----------------------------------------------------------------
+      // This function bounds how many expired elements a put() or get() may
+      // purge from its shard; see ExpiringMap::set_expiry_budget. While a
+      // reaper is attached the shards purge nothing inline, and the budget
+      // takes effect again on detach().
+      void set_expiry_budget(size_t budget);
+
+      //
+      // Member function: expiry_footprint
+      // Usage: auto fp = emap.expiry_footprint();
+      // ----------------------------------------------------------------
+      // This function returns the sum of the shards' expiry index footprints;
+      // see ExpiringMap::expiry_footprint.
+      ExpiryFootprint expiry_footprint() const;
+
+      //
+      // Member function: set_eviction_listener
+      // Usage: emap.set_eviction_listener([](std::vector<Eviction<K, V>>& evicted) { ... });
+      // ----------------------------------------------------------------
+      // This function sets the function to which elements are handed as they
+      // leave the map; see ExpiringMap::set_eviction_listener. Each batch
+      // holds what one call evicted from one shard and is delivered after the
+      // shard is unlocked, so the listener may use the map, but it may run on
+      // several threads at once, including the reaper's. Set it before the
+      // map is shared.
+      void set_eviction_listener(EvictionListener<K, V> listener);
+
+      size_t shards() const noexcept { return shards_.size(); }
+
+  private:
+      struct Shard {
+          mutable std::mutex lock;
+          ExpiringMap<K, V, Expiry, Clock> map;
+      };
+
+      std::vector<std::unique_ptr<Shard>> shards_;
+      Hash hash_;
+      std::atomic<size_t> expire_cursor_{0};
+      ExpiryReaper* reaper_ = nullptr;
+      size_t reaper_task_ = 0;
+      std::unique_ptr<ExpiryReaper> owned_reaper_;
+      size_t expiry_budget_ = expire_all;
+      EvictionListener<K, V> eviction_listener_;
+
+      // Locks a shard for a call that may evict. The call ends with
+      // deliver(), which unlocks the shard and hands whatever its map
+      // evicted meanwhile to the listener, outside the lock. If the call
+      // throws first, the guard only unlocks, and the evictions are left for
+      // the shard's next call.
+      class ShardGuard {
+      public:
+          ShardGuard(const ConcurrentExpiringMap& owner, Shard& shard) : owner_{owner}, shard_{shard}, guard_{shard.lock} {}
+
+          void deliver() {
+              if (shard_.map.evictions_.empty()) {
+                  guard_.unlock();
+                  return;
+              }
+              auto batch = std::vector<Eviction<K, V>>{};
+              batch.swap(shard_.map.evictions_);
+              guard_.unlock();
+              owner_.eviction_listener_(batch);
+          }
+      private:
+          const ConcurrentExpiringMap& owner_;
+          Shard& shard_;
+          std::unique_lock<std::mutex> guard_;
+      };
+
+      // a key of a batch with its shard and its position in the batch
+      template<typename It>
+      struct BatchEntry {
+          size_t shard;
+          It it;
+          size_t index;
+      };
+
+      void set_shard_budget(size_t budget);
+      template<typename It, typename KeyOf>
+      std::vector<BatchEntry<It>> sharded_batch(It first, It last, KeyOf key_of) const;
+
+      size_t shard_index(const K& key) const {
+          auto h = static_cast<std::uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ULL;
+          return static_cast<size_t>(h >> 32) & (shards_.size() - 1);
+      }
+      Shard& shard_for(const K& key) const { return *shards_[shard_index(key)]; }
+  };
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::ConcurrentExpiringMap(size_t shards) {
+      if (shards == 0) shards = 4 * std::max(1U, std::thread::hardware_concurrency());
+      auto count = size_t{1};
+      while (count < shards) count *= 2;
+      shards_.reserve(count);
+      for (size_t i = 0; i < count; ++i) shards_.emplace_back(new Shard{});
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::~ConcurrentExpiringMap() {
+      detach();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::put(const K& key, const V& value, long ms) {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      shard.map.put(key, value, ms);
+      guard.deliver();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::put(K&& key, V&& value, long ms) {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      shard.map.put(std::move(key), std::move(value), ms);
+      guard.deliver();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename KK, typename... Args>
+  inline bool ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::try_emplace(KK&& key, long ms, Args&&... args) {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      auto inserted = shard.map.try_emplace(std::forward<KK>(key), ms, std::forward<Args>(args)...);
+      guard.deliver();
+      return inserted;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename KK, typename M>
+  inline bool ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::insert_or_assign(KK&& key, M&& value, long ms) {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      auto inserted = shard.map.insert_or_assign(std::forward<KK>(key), std::forward<M>(value), ms);
+      guard.deliver();
+      return inserted;
+  }
+
+  // Each run of a batch that falls in one shard is applied under a single
+  // lock, through the shard map's helpers that take the time as an argument.
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename It>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::put_batch(It first, It last, long ms) {
+      auto curtime = Clock::now();
+      auto batch = sharded_batch(first, last, [](const auto& entry) -> const K& { return entry.first; });
+      for (auto run = batch.begin(); run != batch.end();) {
+          auto& shard = *shards_[run->shard];
+          auto end = std::find_if(run, batch.end(), [run](const auto& e) { return e.shard != run->shard; });
+          ShardGuard guard(*this, shard);
+          auto pos = shard.map.internal_map_.begin();
+          for (auto entry = run; entry != end; ++entry) {
+              const auto& key = entry->it->first;
+              pos = shard.map.assign_at(shard.map.seek(pos, key), key, entry->it->second, curtime + ms, curtime).first;
+          }
+          shard.map.clearExpired(curtime, batch_budget(shard.map.expiry_budget_, static_cast<size_t>(end - run)));
+          guard.deliver();
+          run = end;
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename It>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::get_batch(It first, It last, V* out) const {
+      auto curtime = Clock::now();
+      auto batch = sharded_batch(first, last, [](const K& key) -> const K& { return key; });
+      for (auto run = batch.begin(); run != batch.end();) {
+          auto& shard = *shards_[run->shard];
+          auto end = std::find_if(run, batch.end(), [run](const auto& e) { return e.shard != run->shard; });
+          ShardGuard guard(*this, shard);
+          auto& map = shard.map;
+          if (map.expiry_budget_ != expire_all)
+              map.clearExpired(curtime, batch_budget(map.expiry_budget_, static_cast<size_t>(end - run)));
+          auto pos = map.internal_map_.begin();
+          for (auto entry = run; entry != end; ++entry) {
+              pos = map.seek(pos, *entry->it);
+              auto live = pos != map.internal_map_.end() && !map.internal_map_.key_comp()(*entry->it, pos->first) &&
+                  pos->second.getExpire() > curtime;
+              out[entry->index] = live ? pos->second.getValue() : V{};
+          }
+          guard.deliver();
+          run = end;
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename It>
+  inline size_t ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::erase_batch(It first, It last) {
+      auto erased = size_t{0};
+      auto batch = sharded_batch(first, last, [](const K& key) -> const K& { return key; });
+      for (auto run = batch.begin(); run != batch.end();) {
+          auto& shard = *shards_[run->shard];
+          auto end = std::find_if(run, batch.end(), [run](const auto& e) { return e.shard != run->shard; });
+          ShardGuard guard(*this, shard);
+          for (auto entry = run; entry != end; ++entry) erased += shard.map.remove_key(*entry->it);
+          guard.deliver();
+          run = end;
+      }
+      return erased;
+  }
+
+  // the batch ordered by shard, and by key within a shard; ties keep the
+  // batch order, so a repeated key is applied in the order it was given in
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename It, typename KeyOf>
+  inline std::vector<typename ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::template BatchEntry<It>>
+  ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::sharded_batch(It first, It last, KeyOf key_of) const {
+      auto batch = std::vector<BatchEntry<It>>{};
+      batch.reserve(static_cast<size_t>(std::distance(first, last)));
+      for (size_t i = 0; first != last; ++first, ++i) batch.push_back({shard_index(key_of(*first)), first, i});
+      auto less = shards_.front()->map.internal_map_.key_comp();
+      std::sort(batch.begin(), batch.end(), [&less, &key_of](const auto& a, const auto& b) {
+          if (a.shard != b.shard) return a.shard < b.shard;
+          if (less(key_of(*a.it), key_of(*b.it))) return true;
+          return !less(key_of(*b.it), key_of(*a.it)) && a.index < b.index;
+      });
+      return batch;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline V ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::get(const K& key) const {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      auto value = shard.map.get(key);
+      guard.deliver();
+      return value;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline auto ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::lookup(const K& key) const -> handle {
+      auto& shard = shard_for(key);
+      std::unique_lock<std::mutex> guard(shard.lock);
+      auto value = shard.map.lookup(key);
+      if (!value) guard.unlock();
+      return handle(std::move(guard), value);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline std::vector<K> ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::keys() const {
+      auto curtime = Clock::now();
+      auto live = std::vector<std::pair<long, K>>{};
+      for (const auto& shard : shards_) {
+          std::lock_guard<std::mutex> guard(shard->lock);
+          for (const auto& node : shard->map.internal_map_) {
+              if (node.second.getExpire() > curtime)
+                  live.emplace_back(node.second.getExpire(), node.first);
+          }
+      }
+      std::sort(live.begin(), live.end());
+      auto keys = std::vector<K>{};
+      keys.reserve(live.size());
+      for (auto& entry : live) keys.push_back(std::move(entry.second));
+      return keys;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename F>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::for_each_live(F&& fn) const {
+      auto curtime = Clock::now();
+      for (const auto& shard : shards_) {
+          std::lock_guard<std::mutex> guard(shard->lock);
+          for (const auto& node : shard->map.internal_map_) {
+              if (node.second.getExpire() > curtime) fn(node.first, node.second.getValue());
+          }
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline long ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::left(const K& key) const {
+      auto& shard = shard_for(key);
+      std::lock_guard<std::mutex> guard(shard.lock);
+      return shard.map.left(key);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline long ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::next_expiry() const {
+      auto next = -1L;
+      for (const auto& shard : shards_) {
+          std::lock_guard<std::mutex> guard(shard->lock);
+          auto left = shard->map.next_expiry();
+          if (left >= 0 && (next < 0 || left < next)) next = left;
+      }
+      return next;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  template<typename F>
+  inline size_t ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::expiring_within(long ms, F&& fn, size_t limit) const {
+      auto curtime = Clock::now();
+      auto soonest = std::vector<std::tuple<long, K, V>>{};
+      if (!limit) return 0;
+      for (const auto& shard : shards_) {
+          std::lock_guard<std::mutex> guard(shard->lock);
+          auto taken = size_t{0};
+          shard->map.expired_queue_.visit([&](const auto* item) {
+              if (item->getExpire() <= curtime) return true;
+              if (item->getExpire() - curtime > ms) return false;
+              soonest.emplace_back(item->getExpire(), item->getKey(), item->getValue());
+              return ++taken < limit;
+          });
+      }
+      std::stable_sort(soonest.begin(), soonest.end(), [](const auto& a, const auto& b) {
+          return std::get<0>(a) < std::get<0>(b);
+      });
+      if (soonest.size() > limit) soonest.resize(limit);
+      for (const auto& entry : soonest) fn(std::get<1>(entry), std::get<2>(entry));
+      return soonest.size();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline bool ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::touch(const K& key, long ms) {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      auto touched = shard.map.touch(key, ms);
+      guard.deliver();
+      return touched;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline V ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::get_and_touch(const K& key, long ms) {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      auto value = shard.map.get_and_touch(key, ms);
+      guard.deliver();
+      return value;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::erase(const K& key) {
+      auto& shard = shard_for(key);
+      ShardGuard guard(*this, shard);
+      shard.map.erase(key);
+      guard.deliver();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::clear() {
+      for (auto& shard : shards_) {
+          ShardGuard guard(*this, *shard);
+          shard->map.clear();
+          guard.deliver();
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline size_t ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::size() const {
+      auto total = size_t{0};
+      for (const auto& shard : shards_) {
+          ShardGuard guard(*this, *shard);
+          total += shard->map.size();
+          guard.deliver();
+      }
+      return total;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline ExpiryFootprint ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::expiry_footprint() const {
+      auto total = ExpiryFootprint{};
+      for (const auto& shard : shards_) {
+          std::lock_guard<std::mutex> guard(shard->lock);
+          total += shard->map.expiry_footprint();
+      }
+      return total;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline size_t ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::expire(size_t budget) {
+      auto expired = size_t{0};
+      auto count = shards_.size();
+      auto start = expire_cursor_++;
+      for (size_t i = 0; i < count && expired < budget; ++i) {
+          auto& shard = *shards_[(start + i) & (count - 1)];
+          ShardGuard guard(*this, shard);
+          expired += shard.map.expire(budget - expired);
+          guard.deliver();
+      }
+      return expired;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::attach(ExpiryReaper& reaper) {
+      detach();
+      set_shard_budget(0);
+      reaper_ = &reaper;
+      reaper_task_ = reaper.add([this](size_t budget) { return expire(budget); });
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::start_reaper(std::chrono::milliseconds interval, size_t budget) {
+      detach();
+      owned_reaper_.reset(new ExpiryReaper(interval, budget));
+      attach(*owned_reaper_);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::detach() {
+      if (!reaper_) return;
+      reaper_->remove(reaper_task_);
+      reaper_ = nullptr;
+      set_shard_budget(expiry_budget_);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::set_expiry_budget(size_t budget) {
+      expiry_budget_ = budget;
+      if (!reaper_) set_shard_budget(budget);
+  }
+
+  // The shard maps record evictions without a listener of their own, and
+  // ShardGuard delivers them.
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::set_eviction_listener(EvictionListener<K, V> listener) {
+      eviction_listener_ = std::move(listener);
+      for (auto& shard : shards_) {
+          std::lock_guard<std::mutex> guard(shard->lock);
+          shard->map.track_evictions_ = static_cast<bool>(eviction_listener_);
+          shard->map.evictions_.clear();
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Clock>
+  inline void ConcurrentExpiringMap<K, V, Expiry, Hash, Clock>::set_shard_budget(size_t budget) {
+      for (auto& shard : shards_) {
+          std::lock_guard<std::mutex> guard(shard->lock);
+          shard->map.set_expiry_budget(budget);
+      }
+  }
+
+}
+
+#endif // PJ4DEV_CONCURRENTEXPIRINGMAP_H
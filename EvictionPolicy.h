@@ -0,0 +1,375 @@
+//
+// @file: EvictionPolicy.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_EVICTIONPOLICY_H
+#define PJ4DEV_EVICTIONPOLICY_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+namespace pj4dev {
+
+  //
+  // Eviction policies
+  // ----------------------------------------------------------------
+  // An ExpiringMap given a capacity (see ExpiringMap::set_capacity) evicts
+  // live elements once expired ones are gone, and its Evict policy picks
+  // which. Like an expiry policy, a policy is a hook embedded in every node
+  // and an index threaded through the hooks: the map calls insert() for a new
+  // node, access() when a node is read or written, remove() when it leaves,
+  // and victim() for the node to evict next, which it then removes; bytes()
+  // is what the index allocates besides the hooks. Nodes provide
+  // evict_hook() and getKey(). NoEviction is the default and costs nothing.
+
+  //
+  // Struct: NoEviction
+  // Usage: ExpiringMap<K, V, HeapExpiry, SteadyClock, NoEviction> emap;
+  // ----------------------------------------------------------------
+  // Elements only leave by expiry or erase; the map cannot be bounded.
+  struct NoEviction {
+      template<typename Node>
+      struct hook {};
+
+      template<typename Node>
+      class index {
+      public:
+          void insert(Node*) noexcept {}
+          void access(Node*) noexcept {}
+          void remove(Node*) noexcept {}
+          Node* victim() noexcept { return nullptr; }
+          void set_capacity(size_t) noexcept {}
+          void clear() noexcept {}
+          size_t bytes() const noexcept { return 0; }
+      };
+  };
+
+  //
+  // Class: EvictionList
+  // ----------------------------------------------------------------
+  // A doubly-linked list threaded through the prev and next pointers of the
+  // nodes' eviction hooks, most recently used first. Linking and unlinking
+  // are O(1) and never allocate.
+  template<typename Node>
+  class EvictionList {
+  public:
+      void push_front(Node* node) noexcept {
+          auto& h = node->evict_hook();
+          h.prev = nullptr;
+          h.next = head_;
+          if (head_) head_->evict_hook().prev = node;
+          else tail_ = node;
+          head_ = node;
+          ++size_;
+      }
+
+      void remove(Node* node) noexcept {
+          auto& h = node->evict_hook();
+          if (h.prev) h.prev->evict_hook().next = h.next;
+          else head_ = h.next;
+          if (h.next) h.next->evict_hook().prev = h.prev;
+          else tail_ = h.prev;
+          --size_;
+      }
+
+      void move_to_front(Node* node) noexcept {
+          if (node == head_) return;
+          remove(node);
+          push_front(node);
+      }
+
+      Node* back() const noexcept { return tail_; }
+      size_t size() const noexcept { return size_; }
+      void clear() noexcept { head_ = tail_ = nullptr; size_ = 0; }
+
+  private:
+      Node* head_ = nullptr;
+      Node* tail_ = nullptr;
+      size_t size_ = 0;
+  };
+
+  //
+  // Struct: LruEviction
+  // Usage: ExpiringMap<K, V, HeapExpiry, SteadyClock, LruEviction> emap;
+  // ----------------------------------------------------------------
+  // Evicts the least recently used element. Every access moves the node to
+  // the front of a list, which writes to three nodes even on a read.
+  struct LruEviction {
+      template<typename Node>
+      struct hook {
+          Node* prev = nullptr;
+          Node* next = nullptr;
+      };
+
+      template<typename Node>
+      class index {
+      public:
+          void insert(Node* node) noexcept { list_.push_front(node); }
+          void access(Node* node) noexcept { list_.move_to_front(node); }
+          void remove(Node* node) noexcept { list_.remove(node); }
+          Node* victim() noexcept { return list_.back(); }
+          void set_capacity(size_t) noexcept {}
+          void clear() noexcept { list_.clear(); }
+          size_t bytes() const noexcept { return 0; }
+
+      private:
+          EvictionList<Node> list_;
+      };
+  };
+
+  //
+  // Struct: ClockEviction
+  // Usage: ExpiringMap<K, V, HeapExpiry, SteadyClock, ClockEviction> emap;
+  // ----------------------------------------------------------------
+  // Approximates LRU with the CLOCK (second chance) algorithm: an access only
+  // sets the node's referenced bit, so reads write nothing but that bit, and
+  // the hand gives every referenced node another round, clearing its bit,
+  // before it evicts one that was not used since the hand last passed.
+  struct ClockEviction {
+      template<typename Node>
+      struct hook {
+          Node* prev = nullptr;
+          Node* next = nullptr;
+          bool referenced = false;
+      };
+
+      template<typename Node>
+      class index {
+      public:
+          void insert(Node* node) noexcept {
+              node->evict_hook().referenced = false;
+              list_.push_front(node);
+          }
+          void access(Node* node) noexcept { node->evict_hook().referenced = true; }
+          void remove(Node* node) noexcept { list_.remove(node); }
+
+          // the list is the clock face, and its back is under the hand
+          Node* victim() noexcept {
+              while (auto node = list_.back()) {
+                  if (!node->evict_hook().referenced) return node;
+                  node->evict_hook().referenced = false;
+                  list_.move_to_front(node);
+              }
+              return nullptr;
+          }
+
+          void set_capacity(size_t) noexcept {}
+          void clear() noexcept { list_.clear(); }
+          size_t bytes() const noexcept { return 0; }
+
+      private:
+          EvictionList<Node> list_;
+      };
+  };
+
+  //
+  // Class: FrequencySketch
+  // ----------------------------------------------------------------
+  // A count-min sketch of how often keys were used recently, in 4-bit
+  // counters packed sixteen to a word, with one counter per key in each of
+  // four words. Once ten uses per word were recorded, every counter is
+  // halved, so the counts follow changes in popularity. Resizing forgets
+  // the counts. The table has one word per key of the capacity, rounded up
+  // to a power of two, and at most max_words() (512 MiB).
+  class FrequencySketch {
+  public:
+      static constexpr size_t max_words() noexcept { return size_t{1} << 26; }
+
+      void resize(size_t capacity) {
+          capacity = std::min(capacity, max_words());
+          auto words = size_t{16};
+          while (words < capacity) words *= 2;
+          table_.assign(words, 0);
+          sample_size_ = 10 * words;
+          additions_ = 0;
+      }
+
+      unsigned frequency(std::uint64_t hash) const noexcept {
+          if (table_.empty()) return 0;
+          auto start = static_cast<unsigned>(hash & 3) << 2;
+          auto count = 15U;
+          for (unsigned i = 0; i < 4; ++i) {
+              auto shift = (start + i) << 2;
+              auto counter = static_cast<unsigned>(table_[word_of(hash, i)] >> shift) & 15U;
+              if (counter < count) count = counter;
+          }
+          return count;
+      }
+
+      void increment(std::uint64_t hash) noexcept {
+          if (table_.empty()) return;
+          auto start = static_cast<unsigned>(hash & 3) << 2;
+          auto added = false;
+          for (unsigned i = 0; i < 4; ++i) {
+              auto& word = table_[word_of(hash, i)];
+              auto shift = (start + i) << 2;
+              if (((word >> shift) & 15U) == 15U) continue;
+              word += std::uint64_t{1} << shift;
+              added = true;
+          }
+          if (added && ++additions_ == sample_size_) halve();
+      }
+
+      void clear() noexcept {
+          for (auto& word : table_) word = 0;
+          additions_ = 0;
+      }
+
+      size_t bytes() const noexcept { return table_.capacity() * sizeof(std::uint64_t); }
+      // the number of keys the table is sized for
+      size_t capacity() const noexcept { return table_.size(); }
+
+  private:
+      size_t word_of(std::uint64_t hash, unsigned i) const noexcept {
+          static const std::uint64_t seeds[] = {
+              0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+          };
+          auto h = (hash + seeds[i]) * seeds[i];
+          h += h >> 32;
+          return static_cast<size_t>(h) & (table_.size() - 1);
+      }
+
+      void halve() noexcept {
+          for (auto& word : table_) word = (word >> 1) & 0x7777777777777777ULL;
+          additions_ /= 2;
+      }
+
+      std::vector<std::uint64_t> table_;
+      size_t sample_size_ = 0;
+      size_t additions_ = 0;
+  };
+
+  //
+  // Struct: TinyLfuEviction
+  // Usage: ExpiringMap<K, V, HeapExpiry, SteadyClock, TinyLfuEviction> emap;
+  // ----------------------------------------------------------------
+  // Evicts with W-TinyLFU. New elements enter a small LRU window (1% of the
+  // capacity); the rest is a segmented LRU of a probation and a protected
+  // (80%) segment, and an element used again while on probation is
+  // protected. When the window overflows into a full main space, its least
+  // recent element is admitted only if a FrequencySketch estimates it was
+  // used more often than the main space's victim, so one-off keys and scans
+  // cannot flush the popular ones. The segments are sized from the number
+  // of elements each time one is evicted, so they follow a bound on bytes as
+  // well as one on entries. set_capacity() only caps the sketch, which
+  // starts small and doubles as the number of elements outgrows it, so a
+  // generous bound on an empty map allocates nothing up front. Keys are
+  // hashed with std::hash once, on insert.
+  struct TinyLfuEviction {
+      enum class segment : std::uint8_t { window, probation, protect };
+
+      template<typename Node>
+      struct hook {
+          Node* prev = nullptr;
+          Node* next = nullptr;
+          std::uint64_t hash = 0;
+          segment where = segment::window;
+      };
+
+      template<typename Node>
+      class index {
+      public:
+          void insert(Node* node) {
+              auto& h = node->evict_hook();
+              h.hash = spread(std::hash<typename std::decay<decltype(node->getKey())>::type>()(node->getKey()));
+              h.where = segment::window;
+              window_.push_front(node);
+              // the sketch grows with the elements, up to the capacity
+              auto size = window_.size() + main_size();
+              if (size > sketch_.capacity() && sketch_.capacity() < limit_) sketch_.resize(std::min(2 * size, limit_));
+              sketch_.increment(h.hash);
+          }
+
+          void access(Node* node) noexcept {
+              auto& h = node->evict_hook();
+              sketch_.increment(h.hash);
+              if (h.where == segment::probation) {
+                  probation_.remove(node);
+                  h.where = segment::protect;
+                  protected_.push_front(node);
+                  // the protected segment's overflow is put on probation again
+                  while (protected_.size() > protected_capacity_) {
+                      auto demoted = protected_.back();
+                      protected_.remove(demoted);
+                      demoted->evict_hook().where = segment::probation;
+                      probation_.push_front(demoted);
+                  }
+              } else {
+                  list_of(h.where).move_to_front(node);
+              }
+          }
+
+          void remove(Node* node) noexcept { list_of(node->evict_hook().where).remove(node); }
+
+          Node* victim() noexcept {
+              // the map asks when it holds one element too many
+              resize(window_.size() + main_size() - 1);
+              // the window's overflow moves to the main space while it has room
+              while (window_.size() > window_capacity_ && main_size() < main_capacity_) admit(window_.back());
+              auto main_victim = probation_.back() ? probation_.back() : protected_.back();
+              if (window_.size() <= window_capacity_) return main_victim ? main_victim : window_.back();
+              auto candidate = window_.back();
+              if (!main_victim) return candidate;
+              if (sketch_.frequency(candidate->evict_hook().hash) <= sketch_.frequency(main_victim->evict_hook().hash))
+                  return candidate;
+              admit(candidate);
+              return main_victim;
+          }
+
+          void set_capacity(size_t capacity) {
+              limit_ = std::min(capacity, FrequencySketch::max_words());
+              sketch_.resize(std::min(window_.size() + main_size(), limit_));
+          }
+
+          void clear() noexcept {
+              window_.clear();
+              probation_.clear();
+              protected_.clear();
+              sketch_.clear();
+          }
+
+          size_t bytes() const noexcept { return sketch_.bytes(); }
+
+      private:
+          static std::uint64_t spread(size_t hash) noexcept {
+              auto h = static_cast<std::uint64_t>(hash) * 0x9E3779B97F4A7C15ULL;
+              return h ^ (h >> 32);
+          }
+
+          EvictionList<Node>& list_of(segment where) noexcept {
+              return where == segment::window ? window_ : where == segment::probation ? probation_ : protected_;
+          }
+
+          size_t main_size() const noexcept { return probation_.size() + protected_.size(); }
+
+          void resize(size_t capacity) noexcept {
+              window_capacity_ = capacity / 100 ? capacity / 100 : 1;
+              main_capacity_ = capacity > window_capacity_ ? capacity - window_capacity_ : 0;
+              protected_capacity_ = main_capacity_ / 5 * 4;
+          }
+
+          void admit(Node* node) noexcept {
+              window_.remove(node);
+              node->evict_hook().where = segment::probation;
+              probation_.push_front(node);
+          }
+
+          EvictionList<Node> window_;
+          EvictionList<Node> probation_;
+          EvictionList<Node> protected_;
+          FrequencySketch sketch_;
+          size_t limit_ = 0; // the most elements the sketch is sized for
+          // until the first eviction, everything fits
+          size_t window_capacity_ = static_cast<size_t>(-1);
+          size_t main_capacity_ = 0;
+          size_t protected_capacity_ = static_cast<size_t>(-1);
+      };
+  };
+
+}
+
+#endif // PJ4DEV_EVICTIONPOLICY_H
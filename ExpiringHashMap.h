@@ -0,0 +1,935 @@
+//
+// @file: ExpiringHashMap.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_EXPIRINGHASHMAP_H
+#define PJ4DEV_EXPIRINGHASHMAP_H
+
+#include "ExpiringMap.h"
+
+#include <new>
+#include <cstring>
+
+namespace pj4dev {
+
+  //
+  // Class: ExpiringHashMap
+  // Usage: ExpiringHashMap<K, V> emap;
+  // ----------------------------------------------------------------
+  // This template provides the same interface as ExpiringMap on top of a flat
+  // open-addressing hash table instead of a tree. Every slot keeps its key,
+  // value and deadline inline, and a separate array of one-byte control words
+  // (a 7-bit hash fragment per slot) is probed linearly, so a lookup usually
+  // touches one control cache line and one slot. Keys are unordered; keys()
+  // still returns them sorted by deadline.
+  template<typename K, typename V, typename Hash = std::hash<K>,
+           typename Eq = std::equal_to<K>, typename Expiry = HeapExpiry,
+           typename Clock = SteadyClock>
+  class ExpiringHashMap {
+  private:
+      class Slot; // forward declaration
+
+  public:
+      class const_iterator; // defined below
+      using iterator = const_iterator;
+
+      ExpiringHashMap() = default;
+      // The expiry index points into the slot array, so a copy has to
+      // re-index its own slots and a moved-from map is left empty.
+      ExpiringHashMap(const ExpiringHashMap& other);
+      ExpiringHashMap(ExpiringHashMap&& other) noexcept;
+      ExpiringHashMap& operator=(const ExpiringHashMap& other);
+      ExpiringHashMap& operator=(ExpiringHashMap&& other) noexcept;
+      ~ExpiringHashMap();
+
+      //
+      // Member function: put
+      // Usage: emap.put(key, value, duration);
+      // ----------------------------------------------------------------
+      // This function inserts a key and its associated value into the map with
+      // the duration for expiration (in milliseconds). An existing key is
+      // overwritten in place.
+      void put(const K& key, const V& value, long ms);
+      void put(K&& key, V&& value, long ms);
+
+      //
+      // Member function: try_emplace
+      // Usage: emap.try_emplace(key, duration, args...);
+      // ----------------------------------------------------------------
+      // This function inserts a key with a value constructed from args unless
+      // a live one exists; see ExpiringMap::try_emplace.
+      template<typename... Args>
+      bool try_emplace(const K& key, long ms, Args&&... args) { return emplace_key(key, ms, std::forward<Args>(args)...); }
+      template<typename... Args>
+      bool try_emplace(K&& key, long ms, Args&&... args) { return emplace_key(std::move(key), ms, std::forward<Args>(args)...); }
+
+      //
+      // Member function: insert_or_assign
+      // Usage: emap.insert_or_assign(key, value, duration);
+      // ----------------------------------------------------------------
+      // This function works like put() and forwards the key and the value; see
+      // ExpiringMap::insert_or_assign.
+      template<typename M>
+      bool insert_or_assign(const K& key, M&& value, long ms) { return assign_key(key, std::forward<M>(value), ms); }
+      template<typename M>
+      bool insert_or_assign(K&& key, M&& value, long ms) { return assign_key(std::move(key), std::forward<M>(value), ms); }
+
+      //
+      // Member function: put_batch
+      // Usage: emap.put_batch(entries.begin(), entries.end(), duration);
+      // ----------------------------------------------------------------
+      // This function puts a range of (key, value) pairs with one duration; see
+      // ExpiringMap::put_batch. The table is grown once for the whole batch
+      // and the slots of all its keys are fetched from memory together; a
+      // batch that covers much of the table is visited in slot order.
+      template<typename It>
+      void put_batch(It first, It last, long ms);
+
+      //
+      // Member function: get
+      // Usage: emap.get(key);
+      // ----------------------------------------------------------------
+      // This function retrieves a value from the given key, or the default value
+      // if the key does not exist or has already expired. Through a const
+      // reference it only reads; otherwise, with a bounded expiry budget, it
+      // purges up to that many expired elements on the way.
+      V get(const K& key) const;
+      V get(const K& key);
+
+      //
+      // Member function: get_batch
+      // Usage: emap.get_batch(keys.begin(), keys.end(), values.data());
+      // ----------------------------------------------------------------
+      // This function writes the value of each key in the range, or the
+      // default value, to the corresponding element of out, fetching the
+      // slots of all the keys together; see ExpiringMap::get_batch.
+      template<typename It>
+      void get_batch(It first, It last, V* out) const;
+      template<typename It>
+      void get_batch(It first, It last, V* out);
+
+      //
+      // Member function: lookup
+      // Usage: if (auto value = emap.lookup(key)) use(*value);
+      // ----------------------------------------------------------------
+      // This function returns a pointer to the value of the given key without
+      // copying it, or nullptr; see ExpiringMap::lookup. A put() of a new key
+      // may also move the values when the table grows.
+      const V* lookup(const K& key) const;
+
+      //
+      // Member function: keys
+      // Usage: auto keys = emap.keys();
+      // ----------------------------------------------------------------
+      // This function returns the keys which are still valid, ordered by their
+      // expiration time.
+      std::vector<K> keys() const;
+
+      //
+      // Member function: key_stream
+      // Usage: for (const auto& key : emap.key_stream()) use(key);
+      // ----------------------------------------------------------------
+      // This function returns the keys of keys() as a KeyStream, which reads
+      // them in place and orders them as they are consumed.
+      KeyStream<K> key_stream() const;
+
+      //
+      // Member function: begin, end
+      // Usage: for (const auto& entry : emap) use(entry.first, entry.second);
+      // ----------------------------------------------------------------
+      // These functions iterate over the live elements in slot order, reading
+      // the time once; see ExpiringMap::begin.
+      const_iterator begin() const;
+      const_iterator end() const;
+
+      //
+      // Member function: for_each_live
+      // Usage: emap.for_each_live([](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with the key and the value of every live
+      // element, in slot order, reading the time once.
+      template<typename F>
+      void for_each_live(F&& fn) const;
+
+      //
+      // Member function: left
+      // Usage: auto timeLeft = emap.left(key);
+      // ----------------------------------------------------------------
+      // This function returns the remaining time (in milliseconds) of the key,
+      // or zero if it doesn't exist or has already expired.
+      long left(const K& key) const;
+
+      //
+      // Member function: next_expiry
+      // Usage: auto timeLeft = emap.next_expiry();
+      // ----------------------------------------------------------------
+      // This function returns the remaining time (in milliseconds) of the
+      // element that expires first, or -1 if no element is live; see
+      // ExpiringMap::next_expiry.
+      long next_expiry() const;
+
+      //
+      // Member function: expiring_within
+      // Usage: emap.expiring_within(duration, [](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with each live element that expires within the
+      // given duration, soonest first, up to limit elements, and returns how
+      // many it visited; see ExpiringMap::expiring_within.
+      template<typename F>
+      size_t expiring_within(long ms, F&& fn, size_t limit = SIZE_MAX) const;
+
+      //
+      // Member function: touch
+      // Usage: emap.touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function resets the remaining time of a live key without touching
+      // its value; see ExpiringMap::touch.
+      bool touch(const K& key, long ms);
+
+      //
+      // Member function: get_and_touch
+      // Usage: auto value = emap.get_and_touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function returns the value of a live key and resets its remaining
+      // time with a single lookup; see ExpiringMap::get_and_touch.
+      V get_and_touch(const K& key, long ms);
+
+      //
+      // Member function: erase
+      // Usage: emap.erase(key);
+      // ----------------------------------------------------------------
+      // This function deletes a key and its associated value from the map.
+      void erase(const K& key);
+
+      //
+      // Member function: erase_batch
+      // Usage: auto n = emap.erase_batch(keys.begin(), keys.end());
+      // ----------------------------------------------------------------
+      // This function deletes every key in the range and returns how many of
+      // them were in the map.
+      template<typename It>
+      size_t erase_batch(It first, It last);
+
+      //
+      // Member function: clear
+      // Usage: emap.clear();
+      // ----------------------------------------------------------------
+      // This function removes all elements but keeps the table allocated.
+      void clear();
+
+      //
+      // Member function: size
+      // Usage: auto s = emap.size();
+      // ----------------------------------------------------------------
+      // This function returns the number of non-expired elements. It purges
+      // nothing: the elements that have expired are counted in the expiry
+      // index and subtracted, as ExpiringMap::size() does.
+      size_t size() const;
+
+      //
+      // Member function: expire
+      // Usage: auto n = emap.expire(budget);
+      // ----------------------------------------------------------------
+      // This function removes up to `budget` expired elements and returns how
+      // many were removed; see ExpiringMap::expire.
+      size_t expire(size_t budget = expire_all);
+
+      //
+      // Member function: set_expiry_budget
+      // Usage: emap.set_expiry_budget(64);
+      // ----------------------------------------------------------------
+      // This function bounds how many expired elements a put() or get() may
+      // purge; see ExpiringMap::set_expiry_budget.
+      void set_expiry_budget(size_t budget) noexcept { expiry_budget_ = budget; }
+
+      //
+      // Member function: expiry_footprint
+      // Usage: auto fp = emap.expiry_footprint();
+      // ----------------------------------------------------------------
+      // This function reports the memory held by the expiry index; see
+      // ExpiringMap::expiry_footprint.
+      ExpiryFootprint expiry_footprint() const noexcept { return expired_queue_.footprint(); }
+
+      //
+      // Member function: set_eviction_listener
+      // Usage: emap.set_eviction_listener([](std::vector<Eviction<K, V>>& evicted) { ... });
+      // ----------------------------------------------------------------
+      // This function sets the function to which elements are handed, in
+      // batches, as they leave the map; see ExpiringMap::set_eviction_listener.
+      void set_eviction_listener(EvictionListener<K, V> listener) {
+          eviction_listener_ = std::move(listener);
+          track_evictions_ = static_cast<bool>(eviction_listener_);
+      }
+
+  private:
+      class Slot {
+      public:
+          using hook_type = typename Expiry::template hook<Slot>;
+          template<typename KK, typename... Args>
+          Slot(KK&& k, long exp, Args&&... args)
+            : key_(std::forward<KK>(k)), value_(std::forward<Args>(args)...), expire_{exp}{}
+          Slot(const Slot& other)
+            : key_{other.key_}, value_{other.value_}, expire_{other.expire_}{}
+          Slot(Slot&& other)
+            : key_{std::move(other.key_)}, value_{std::move(other.value_)}, expire_{other.expire_}{}
+          const K& getKey() const noexcept { return key_; }
+          const V& getValue() const noexcept { return value_; }
+          long getExpire() const noexcept { return expire_; }
+          void setExpire(long exp) noexcept { expire_ = exp; }
+          hook_type& hook() noexcept { return hook_; }
+          template<typename M>
+          void assign(M&& v, long exp) { value_ = std::forward<M>(v); expire_ = exp; }
+          // sets the value and the deadline, and returns the value replaced
+          template<typename M>
+          V exchange(M&& v, long exp) {
+              auto old = std::exchange(value_, V(std::forward<M>(v)));
+              expire_ = exp;
+              return old;
+          }
+          V takeValue() { return std::move(value_); }
+      private:
+          K key_;
+          V value_;
+          long expire_;
+          hook_type hook_;
+      };
+
+      // control words: empty, deleted (tombstone), or full | 7-bit hash
+      static constexpr std::uint8_t empty = 0x00;
+      static constexpr std::uint8_t deleted = 0x01;
+      static constexpr std::uint8_t full = 0x80;
+      static constexpr size_t npos = static_cast<size_t>(-1);
+      static constexpr size_t min_capacity = 16;
+
+      typename Expiry::template index<Slot> expired_queue_;
+      std::uint8_t* ctrl_ = nullptr;
+      Slot* slots_ = nullptr;
+      size_t capacity_ = 0;      // zero or a power of two
+      size_t size_ = 0;  // full slots
+      size_t used_ = 0;  // full and deleted slots
+      Hash hash_;
+      Eq eq_;
+      size_t expiry_budget_ = expire_all;
+      EvictionListener<K, V> eviction_listener_;
+      std::vector<Eviction<K, V>> evictions_;
+      bool track_evictions_ = false;
+
+      static long current_time() noexcept { return Clock::now(); }
+
+      size_t hash_of(const K& key) const {
+          auto h = static_cast<std::uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ULL;
+          return static_cast<size_t>(h ^ (h >> 32));
+      }
+      static std::uint8_t tag_of(size_t h) noexcept { return full | (h & 0x7F); }
+      // a hint to bring p's cache line in; nothing on compilers without one
+      static void prefetch(const void* p) noexcept {
+  #if defined(__GNUC__)
+          __builtin_prefetch(p);
+  #else
+          (void)p;
+  #endif
+      }
+
+      // a key of a batch with its hash and its position in the batch
+      template<typename It>
+      struct BatchEntry {
+          size_t hash;
+          It it;
+          size_t index;
+      };
+
+      size_t find(const K& key) const { return find(key, hash_of(key)); }
+      size_t find(const K& key, size_t h) const;
+      size_t insert_slot(size_t h);
+      void erase_at(size_t pos) noexcept;
+      void rehash(size_t capacity);
+      void reset() noexcept;
+      void release() noexcept;
+      void evicted(Slot& slot, EvictionReason reason) {
+          if (track_evictions_) evictions_.push_back({slot.getKey(), slot.takeValue(), reason});
+      }
+      // the new value is in place before the old one is reported, so a new
+      // value read from the old one is read intact
+      template<typename M>
+      void overwrite(Slot& slot, M&& value, long expire, EvictionReason reason) {
+          if (!track_evictions_) {
+              slot.assign(std::forward<M>(value), expire);
+              return;
+          }
+          auto old = slot.exchange(std::forward<M>(value), expire);
+          evictions_.push_back({slot.getKey(), std::move(old), reason});
+      }
+      void deliver_evictions();
+      std::vector<std::pair<long, const K*>> live_entries() const;
+      size_t clearExpired(long now, size_t budget);
+
+      template<typename KK, typename... Args>
+      bool emplace_key(KK&& key, long ms, Args&&... args);
+      template<typename KK, typename M>
+      bool assign_key(KK&& key, M&& value, long ms);
+      template<typename KK, typename... Args>
+      void emplace_slot(size_t h, KK&& key, long expire, Args&&... args);
+      template<typename KK, typename M>
+      bool assign_at(size_t h, KK&& key, M&& value, long expire, long curtime);
+      template<typename It, typename KeyOf>
+      std::vector<BatchEntry<It>> hashed_batch(It first, It last, KeyOf key_of) const;
+      template<typename It>
+      void order_batch(std::vector<BatchEntry<It>>& batch) const;
+  };
+
+  //
+  // Class: ExpiringHashMap::const_iterator
+  // ----------------------------------------------------------------
+  // A forward iterator over the slots of an ExpiringHashMap that were live at
+  // a given time. It dereferences to a (key, value) pair of references.
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  class ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::const_iterator {
+  public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<const K&, const V&>;
+      using difference_type = std::ptrdiff_t;
+      using pointer = void;
+      using reference = std::pair<const K&, const V&>;
+
+      const_iterator() = default;
+      reference operator*() const noexcept { return {map_->slots_[pos_].getKey(), map_->slots_[pos_].getValue()}; }
+      const_iterator& operator++() noexcept { ++pos_; skip(); return *this; }
+      const_iterator operator++(int) noexcept { auto it = *this; ++*this; return it; }
+      bool operator==(const const_iterator& other) const noexcept { return pos_ == other.pos_; }
+      bool operator!=(const const_iterator& other) const noexcept { return pos_ != other.pos_; }
+
+  private:
+      friend class ExpiringHashMap;
+
+      const_iterator(const ExpiringHashMap* map, size_t pos, long now) noexcept
+        : map_{map}, pos_{pos}, now_{now} { skip(); }
+      void skip() noexcept {
+          while (pos_ < map_->capacity_ &&
+                 (!(map_->ctrl_[pos_] & full) || map_->slots_[pos_].getExpire() <= now_)) ++pos_;
+      }
+
+      const ExpiringHashMap* map_ = nullptr;
+      size_t pos_ = 0;
+      long now_ = 0;
+  };
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::ExpiringHashMap(const ExpiringHashMap& other)
+    : hash_{other.hash_}, eq_{other.eq_}, expiry_budget_{other.expiry_budget_} {
+      if (!other.capacity_) return;
+      // slots keep their positions, tombstones included, so probe chains
+      // stay intact
+      ctrl_ = new std::uint8_t[other.capacity_]();
+      slots_ = std::allocator<Slot>{}.allocate(other.capacity_);
+      capacity_ = other.capacity_;
+      for (size_t pos = 0; pos < capacity_; ++pos) {
+          if (other.ctrl_[pos] & full) {
+              new (&slots_[pos]) Slot(other.slots_[pos]);
+              ctrl_[pos] = other.ctrl_[pos];
+              ++size_;
+              expired_queue_.insert(&slots_[pos]);
+          } else {
+              ctrl_[pos] = other.ctrl_[pos];
+          }
+      }
+      used_ = other.used_;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::ExpiringHashMap(ExpiringHashMap&& other) noexcept
+    : expired_queue_{std::move(other.expired_queue_)}, ctrl_{other.ctrl_}, slots_{other.slots_},
+      capacity_{other.capacity_}, size_{other.size_}, used_{other.used_},
+      hash_{other.hash_}, eq_{other.eq_}, expiry_budget_{other.expiry_budget_},
+      eviction_listener_{std::move(other.eviction_listener_)}, track_evictions_{other.track_evictions_} {
+      other.ctrl_ = nullptr;
+      other.slots_ = nullptr;
+      other.capacity_ = other.size_ = other.used_ = 0;
+      other.expired_queue_.clear();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>&
+  ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::operator=(const ExpiringHashMap& other) {
+      if (this != &other) {
+          auto copy = other;
+          copy.eviction_listener_ = std::move(eviction_listener_);
+          copy.track_evictions_ = track_evictions_;
+          *this = std::move(copy);
+      }
+      return *this;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>&
+  ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::operator=(ExpiringHashMap&& other) noexcept {
+      if (this != &other) {
+          release();
+          expired_queue_ = std::move(other.expired_queue_);
+          std::swap(ctrl_, other.ctrl_);
+          std::swap(slots_, other.slots_);
+          std::swap(capacity_, other.capacity_);
+          std::swap(size_, other.size_);
+          std::swap(used_, other.used_);
+          hash_ = other.hash_;
+          eq_ = other.eq_;
+          expiry_budget_ = other.expiry_budget_;
+          eviction_listener_ = std::move(other.eviction_listener_);
+          track_evictions_ = other.track_evictions_;
+          other.expired_queue_.clear();
+      }
+      return *this;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::~ExpiringHashMap() {
+      release();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::put(const K& key, const V& value, long ms) {
+      assign_key(key, value, ms);
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::put(K&& key, V&& value, long ms) {
+      assign_key(std::move(key), std::move(value), ms);
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename KK, typename... Args>
+  inline bool ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::emplace_key(KK&& key, long ms, Args&&... args) {
+      auto curtime = current_time();
+      auto h = hash_of(key);
+      auto pos = find(key, h);
+      if (pos != npos) {
+          auto& slot = slots_[pos];
+          if (slot.getExpire() > curtime) return false;
+          overwrite(slot, V(std::forward<Args>(args)...), curtime + ms, EvictionReason::expired);
+          expired_queue_.update(&slot);
+      } else {
+          emplace_slot(h, std::forward<KK>(key), curtime + ms, std::forward<Args>(args)...);
+      }
+      clearExpired(curtime, expiry_budget_);
+      deliver_evictions();
+      return true;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename KK, typename M>
+  inline bool ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::assign_key(KK&& key, M&& value, long ms) {
+      auto curtime = current_time();
+      auto inserted = assign_at(hash_of(key), std::forward<KK>(key), std::forward<M>(value), curtime + ms, curtime);
+      clearExpired(curtime, expiry_budget_);
+      deliver_evictions();
+      return inserted;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename KK, typename M>
+  inline bool ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::assign_at(size_t h, KK&& key, M&& value, long expire, long curtime) {
+      auto pos = find(key, h);
+      if (pos != npos) {
+          auto& slot = slots_[pos];
+          auto inserted = slot.getExpire() <= curtime;
+          overwrite(slot, std::forward<M>(value), expire, inserted ? EvictionReason::expired : EvictionReason::replaced);
+          expired_queue_.update(&slot);
+          return inserted;
+      }
+      emplace_slot(h, std::forward<KK>(key), expire, std::forward<M>(value));
+      return true;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename It>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::put_batch(It first, It last, long ms) {
+      auto curtime = current_time();
+      auto batch = hashed_batch(first, last, [](const auto& entry) -> const K& { return entry.first; });
+      // make room for the whole batch up front, so that no rehash reorders
+      // the table halfway through
+      auto capacity = capacity_ ? capacity_ : min_capacity;
+      while ((size_ + batch.size()) * 8 > capacity * 7) capacity *= 2;
+      if (capacity != capacity_ || (used_ + batch.size()) * 8 > capacity_ * 7) rehash(capacity);
+      order_batch(batch);
+      for (const auto& entry : batch)
+          assign_at(entry.hash, entry.it->first, entry.it->second, curtime + ms, curtime);
+      clearExpired(curtime, batch_budget(expiry_budget_, batch.size()));
+      deliver_evictions();
+  }
+
+  // constructs a slot for a key that is absent, growing the table if needed
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename KK, typename... Args>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::emplace_slot(size_t h, KK&& key, long expire, Args&&... args) {
+      if ((used_ + 1) * 8 > capacity_ * 7)
+          rehash(capacity_ ? capacity_ : min_capacity);
+      auto pos = insert_slot(h);
+      new (&slots_[pos]) Slot(std::forward<KK>(key), expire, std::forward<Args>(args)...);
+      if (ctrl_[pos] == empty) ++used_;
+      ctrl_[pos] = tag_of(h);
+      ++size_;
+      expired_queue_.insert(&slots_[pos]);
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline V ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::get(const K& key) const {
+      auto pos = find(key);
+      if (pos == npos || slots_[pos].getExpire() <= current_time()) return V{};
+      return slots_[pos].getValue();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline V ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::get(const K& key) {
+      // with a bounded budget, reads help drain the backlog as well
+      auto curtime = current_time();
+      if (expiry_budget_ != expire_all) clearExpired(curtime, expiry_budget_);
+      auto value = V{};
+      auto pos = find(key);
+      if (pos != npos && slots_[pos].getExpire() > curtime) value = slots_[pos].getValue();
+      deliver_evictions();
+      return value;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename It>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::get_batch(It first, It last, V* out) const {
+      auto curtime = current_time();
+      auto batch = hashed_batch(first, last, [](const K& key) -> const K& { return key; });
+      order_batch(batch);
+      for (const auto& entry : batch) {
+          auto pos = find(*entry.it, entry.hash);
+          out[entry.index] = pos != npos && slots_[pos].getExpire() > curtime ? slots_[pos].getValue() : V{};
+      }
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename It>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::get_batch(It first, It last, V* out) {
+      auto curtime = current_time();
+      auto batch = hashed_batch(first, last, [](const K& key) -> const K& { return key; });
+      if (expiry_budget_ != expire_all) clearExpired(curtime, batch_budget(expiry_budget_, batch.size()));
+      order_batch(batch);
+      for (const auto& entry : batch) {
+          auto pos = find(*entry.it, entry.hash);
+          out[entry.index] = pos != npos && slots_[pos].getExpire() > curtime ? slots_[pos].getValue() : V{};
+      }
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline const V* ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::lookup(const K& key) const {
+      auto pos = find(key);
+      if (pos == npos || slots_[pos].getExpire() <= current_time()) return nullptr;
+      return &slots_[pos].getValue();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline std::vector<K> ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::keys() const {
+      auto live = live_entries();
+      std::sort(live.begin(), live.end(), [](const auto& a, const auto& b) {
+          return (a.first != b.first)? a.first < b.first : *a.second < *b.second;
+      });
+      auto keys = std::vector<K>{};
+      keys.reserve(live.size());
+      for (const auto& entry : live) keys.push_back(*entry.second);
+      return keys;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline auto ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::begin() const -> const_iterator {
+      return const_iterator(this, 0, current_time());
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline auto ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::end() const -> const_iterator {
+      return const_iterator(this, capacity_, 0);
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename F>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::for_each_live(F&& fn) const {
+      auto curtime = current_time();
+      for (size_t pos = 0; pos < capacity_; ++pos) {
+          if ((ctrl_[pos] & full) && slots_[pos].getExpire() > curtime)
+              fn(slots_[pos].getKey(), slots_[pos].getValue());
+      }
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline KeyStream<K> ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::key_stream() const {
+      return KeyStream<K>(live_entries());
+  }
+
+  // the (deadline, key) pairs of the live keys, in slot order
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline std::vector<std::pair<long, const K*>> ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::live_entries() const {
+      auto curtime = current_time();
+      auto live = std::vector<std::pair<long, const K*>>{};
+      live.reserve(size_);
+      for (size_t pos = 0; pos < capacity_; ++pos) {
+          if ((ctrl_[pos] & full) && slots_[pos].getExpire() > curtime)
+              live.emplace_back(slots_[pos].getExpire(), &slots_[pos].getKey());
+      }
+      return live;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline long ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::left(const K& key) const {
+      auto pos = find(key);
+      if (pos == npos) return 0;
+      return std::max(0L, slots_[pos].getExpire() - current_time());
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline long ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::next_expiry() const {
+      auto curtime = current_time();
+      auto next = -1L;
+      expired_queue_.visit([curtime, &next](const Slot* slot) {
+          if (slot->getExpire() <= curtime) return true; // expired, not purged yet
+          next = slot->getExpire() - curtime;
+          return false;
+      });
+      return next;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename F>
+  inline size_t ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::expiring_within(long ms, F&& fn, size_t limit) const {
+      auto curtime = current_time();
+      auto visited = size_t{0};
+      if (!limit) return 0;
+      expired_queue_.visit([&](const Slot* slot) {
+          if (slot->getExpire() <= curtime) return true;
+          if (slot->getExpire() - curtime > ms) return false;
+          fn(slot->getKey(), slot->getValue());
+          return ++visited < limit;
+      });
+      return visited;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline bool ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::touch(const K& key, long ms) {
+      auto curtime = current_time();
+      auto pos = find(key);
+      auto live = pos != npos && slots_[pos].getExpire() > curtime;
+      if (live) {
+          slots_[pos].setExpire(curtime + ms);
+          expired_queue_.update(&slots_[pos]);
+      }
+      clearExpired(curtime, expiry_budget_);
+      deliver_evictions();
+      return live;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline V ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::get_and_touch(const K& key, long ms) {
+      auto curtime = current_time();
+      auto value = V{};
+      auto pos = find(key);
+      if (pos != npos && slots_[pos].getExpire() > curtime) {
+          value = slots_[pos].getValue();
+          slots_[pos].setExpire(curtime + ms);
+          expired_queue_.update(&slots_[pos]);
+      }
+      clearExpired(curtime, expiry_budget_);
+      deliver_evictions();
+      return value;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::erase(const K& key) {
+      auto pos = find(key);
+      if (pos == npos) return;
+      evicted(slots_[pos], EvictionReason::erased);
+      erase_at(pos);
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename It>
+  inline size_t ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::erase_batch(It first, It last) {
+      auto batch = hashed_batch(first, last, [](const K& key) -> const K& { return key; });
+      order_batch(batch);
+      auto erased = size_t{0};
+      for (const auto& entry : batch) {
+          auto pos = find(*entry.it, entry.hash);
+          if (pos != npos) {
+              evicted(slots_[pos], EvictionReason::erased);
+              erase_at(pos);
+              ++erased;
+          }
+      }
+      deliver_evictions();
+      return erased;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::clear() {
+      if (track_evictions_) {
+          for (size_t pos = 0; pos < capacity_; ++pos) {
+              if (ctrl_[pos] & full) evicted(slots_[pos], EvictionReason::erased);
+          }
+      }
+      reset();
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::reset() noexcept {
+      for (size_t pos = 0; pos < capacity_; ++pos) {
+          if (ctrl_[pos] & full) slots_[pos].~Slot();
+      }
+      if (capacity_) std::memset(ctrl_, empty, capacity_);
+      size_ = used_ = 0;
+      expired_queue_.clear();
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline size_t ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::size() const {
+      return size_ - expired_queue_.count_due(current_time());
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline size_t ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::expire(size_t budget) {
+      auto expired = clearExpired(current_time(), budget);
+      deliver_evictions();
+      return expired;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline size_t ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::find(const K& key, size_t h) const {
+      if (!capacity_) return npos;
+      auto tag = tag_of(h);
+      auto mask = capacity_ - 1;
+      for (auto pos = (h >> 7) & mask; ; pos = (pos + 1) & mask) {
+          auto ctrl = ctrl_[pos];
+          if (ctrl == empty) return npos;
+          if (ctrl == tag && eq_(slots_[pos].getKey(), key)) return pos;
+      }
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename It, typename KeyOf>
+  inline std::vector<typename ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::template BatchEntry<It>>
+  ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::hashed_batch(It first, It last, KeyOf key_of) const {
+      auto batch = std::vector<BatchEntry<It>>{};
+      batch.reserve(static_cast<size_t>(std::distance(first, last)));
+      for (size_t i = 0; first != last; ++first, ++i) batch.push_back({hash_of(key_of(*first)), first, i});
+      return batch;
+  }
+
+  // A batch that covers much of the table is sorted by home slot, so that
+  // the probes sweep it front to back; ties keep the batch order, so a
+  // repeated key is applied in the order it was given in. Sorting a sparse
+  // batch costs more than it saves, so its home slots are prefetched
+  // instead, and the misses of the whole batch overlap rather than being
+  // taken one probe at a time.
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  template<typename It>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::order_batch(std::vector<BatchEntry<It>>& batch) const {
+      if (!capacity_) return;
+      auto mask = capacity_ - 1;
+      if (batch.size() * 16 >= capacity_) {
+          std::sort(batch.begin(), batch.end(), [mask](const auto& a, const auto& b) {
+              auto pa = (a.hash >> 7) & mask, pb = (b.hash >> 7) & mask;
+              return pa != pb ? pa < pb : a.index < b.index;
+          });
+          return;
+      }
+      for (const auto& entry : batch) {
+          prefetch(&ctrl_[(entry.hash >> 7) & mask]);
+          prefetch(&slots_[(entry.hash >> 7) & mask]);
+      }
+  }
+
+  // Returns the first empty or deleted slot on the probe sequence of h.
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline size_t ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::insert_slot(size_t h) {
+      auto mask = capacity_ - 1;
+      auto pos = (h >> 7) & mask;
+      while (ctrl_[pos] & full) pos = (pos + 1) & mask;
+      return pos;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::erase_at(size_t pos) noexcept {
+      expired_queue_.remove(&slots_[pos]);
+      slots_[pos].~Slot();
+      --size_;
+      // With linear probing no chain runs through a slot followed by an empty
+      // one, so it and any tombstones right before it can become empty again.
+      auto mask = capacity_ - 1;
+      if (ctrl_[(pos + 1) & mask] != empty) {
+          ctrl_[pos] = deleted;
+          return;
+      }
+      ctrl_[pos] = empty;
+      --used_;
+      for (auto prev = (pos - 1) & mask; ctrl_[prev] == deleted; prev = (prev - 1) & mask) {
+          ctrl_[prev] = empty;
+          --used_;
+      }
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::rehash(size_t capacity) {
+      // grow when more than half of the slots hold live entries, otherwise
+      // only sweep out the tombstones
+      while (size_ * 2 >= capacity) capacity *= 2;
+      auto old_ctrl = ctrl_;
+      auto old_slots = slots_;
+      auto old_capacity = capacity_;
+      ctrl_ = new std::uint8_t[capacity]();
+      slots_ = std::allocator<Slot>{}.allocate(capacity);
+      capacity_ = capacity;
+      size_ = used_ = 0;
+      expired_queue_.clear();
+      for (size_t pos = 0; pos < old_capacity; ++pos) {
+          if (!(old_ctrl[pos] & full)) continue;
+          auto& slot = old_slots[pos];
+          auto h = hash_of(slot.getKey());
+          auto to = insert_slot(h);
+          new (&slots_[to]) Slot(std::move(slot));
+          slot.~Slot();
+          ctrl_[to] = tag_of(h);
+          ++size_;
+          ++used_;
+          expired_queue_.insert(&slots_[to]);
+      }
+      delete[] old_ctrl;
+      if (old_slots) std::allocator<Slot>{}.deallocate(old_slots, old_capacity);
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::release() noexcept {
+      reset();
+      delete[] ctrl_;
+      if (slots_) std::allocator<Slot>{}.deallocate(slots_, capacity_);
+      ctrl_ = nullptr;
+      slots_ = nullptr;
+      capacity_ = 0;
+  }
+
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline size_t ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::clearExpired(long now, size_t budget) {
+      if (budget == 0) return 0;
+      return expired_queue_.expire(now, budget, [this](Slot* slot) {
+          evicted(*slot, EvictionReason::expired);
+          erase_at(static_cast<size_t>(slot - slots_));
+      });
+  }
+
+  // Hands the elements that left the map during the call that is finishing
+  // to the listener; see ExpiringMap::deliver_evictions.
+  template<typename K, typename V, typename Hash, typename Eq, typename Expiry, typename Clock>
+  inline void ExpiringHashMap<K, V, Hash, Eq, Expiry, Clock>::deliver_evictions() {
+      if (evictions_.empty() || !eviction_listener_) return;
+      auto batch = std::vector<Eviction<K, V>>{};
+      batch.swap(evictions_);
+      eviction_listener_(batch);
+  }
+
+}
+
+#endif // PJ4DEV_EXPIRINGHASHMAP_H
@@ -4,32 +4,622 @@
 // @url: https://github.com/pj4dev/custom-cpp-libs
 //
 
+#ifndef PJ4DEV_EXPIRINGMAP_H
+#define PJ4DEV_EXPIRINGMAP_H
+
+#include "ExpiryClock.h"
+#include "EvictionPolicy.h"
+#include "ExpiryStats.h"
+#include "BitOps.h"
+
 #include <map>
-#include <queue>
+#include <vector>
 #include <chrono>
-#include <memory>
+#include <tuple>
+#include <cstdint>
+#include <climits>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <type_traits>
 
 namespace pj4dev {
 
+  // the expiry budget that puts no limit on the number of entries expired
+  constexpr size_t expire_all = static_cast<size_t>(-1);
+
+  // the expiry budget of a batch of n operations that allow `budget` each
+  inline size_t batch_budget(size_t budget, size_t n) noexcept {
+      if (budget == expire_all || n == 0) return budget;
+      return budget > expire_all / n ? expire_all : budget * n;
+  }
+
+  //
+  // Struct: ExpiryFootprint
+  // Usage: auto fp = emap.expiry_footprint();
+  // ----------------------------------------------------------------
+  // The memory held by an expiry index. The indexes are intrusive: erasing or
+  // overwriting a key unlinks its node at once, so there are never dead
+  // entries waiting for their deadline and `entries` always equals the number
+  // of elements in the map. `reserved` and `bytes` show the spare room the
+  // index keeps on top of that, which stays within a constant factor of it.
+  struct ExpiryFootprint {
+      size_t entries = 0;   // scheduled entries
+      size_t reserved = 0;  // entries the index can hold without allocating
+      size_t bytes = 0;     // bytes the index allocates besides the hooks in the nodes
+
+      ExpiryFootprint& operator+=(const ExpiryFootprint& other) noexcept {
+          entries += other.entries;
+          reserved += other.reserved;
+          bytes += other.bytes;
+          return *this;
+      }
+  };
+
+  //
+  // Enum: EvictionReason
+  // ----------------------------------------------------------------
+  // Why an element left a map, as reported to an eviction listener.
+  enum class EvictionReason {
+      expired,   // its deadline passed: purged, or overwritten after it
+      erased,    // removed by erase(), erase_batch() or clear()
+      replaced,  // its live value was overwritten by a put()
+      capacity   // evicted to keep the map within its bounds
+  };
+
+  //
+  // Struct: Eviction
+  // ----------------------------------------------------------------
+  // An element that left a map, with the reason why.
+  template<typename K, typename V>
+  struct Eviction {
+      K key;
+      V value;
+      EvictionReason reason;
+  };
+
+  // Receives the elements that left a map during one operation, together,
+  // once the operation is complete. The values may be moved out.
+  template<typename K, typename V>
+  using EvictionListener = std::function<void(std::vector<Eviction<K, V>>&)>;
+
+  // Returns the bytes a key and a value hold outside the map's node, such
+  // as the buffer of a long std::string; whatever sizeof(K) and sizeof(V)
+  // cover is already counted with the node.
+  template<typename K, typename V>
+  using Weigher = std::function<size_t(const K&, const V&)>;
+
+  // the bytes malloc reserves for a request of n bytes, rounded up to
+  // 16-byte chunks with an 8-byte header as glibc's malloc does on 64-bit
+  // targets; elsewhere a close estimate
+  constexpr size_t allocation_size(size_t n) noexcept {
+      return n + 8 <= 32 ? 32 : (n + 8 + 15) & ~size_t{15};
+  }
+
+  //
+  // Struct: MemoryUsage
+  // Usage: auto mu = emap.memory_usage();
+  // ----------------------------------------------------------------
+  // The memory held by a map, in bytes, broken down by what holds it.
+  struct MemoryUsage {
+      size_t entries = 0;         // elements in the map, expired ones not purged yet included
+      size_t nodes = 0;           // the map's nodes: key, value, deadline, index hooks and allocator overhead
+      size_t expiry_index = 0;    // what the expiry index allocates besides its hooks, e.g. the heap array
+      size_t eviction_index = 0;  // what the eviction policy allocates besides its hooks, e.g. a sketch
+      size_t payload = 0;         // what keys and values hold outside the nodes, as the weigher reports it
+
+      size_t total() const noexcept { return nodes + expiry_index + eviction_index + payload; }
+  };
+
+  //
+  // Struct: HeapExpiry
+  // Usage: ExpiringMap<K, V, HeapExpiry> emap;
+  // ----------------------------------------------------------------
+  // This expiry policy keeps deadlines in an indexed binary min-heap.
+  // Scheduling, removing and expiring an entry all cost O(log n). The deadline
+  // is cached next to each heap slot so that comparisons never touch the node,
+  // and each node remembers its slot so that it can be unlinked directly.
+  // The heap array gives memory back once it is less than a quarter full, so
+  // its size follows the number of live entries after a mass erase or expiry.
+  struct HeapExpiry {
+      template<typename Node>
+      struct hook {
+          size_t pos = npos;
+          static constexpr size_t npos = static_cast<size_t>(-1);
+      };
+
+      template<typename Node>
+      class index {
+      public:
+          void insert(Node* node) {
+              shrink();
+              heap_.push_back(entry{node->getExpire(), node});
+              sift_up(heap_.size() - 1);
+          }
+
+          void remove(Node* node) noexcept {
+              auto pos = node->hook().pos;
+              if (pos == hook<Node>::npos) return;
+              node->hook().pos = hook<Node>::npos;
+              auto last = heap_.size() - 1;
+              if (pos != last) {
+                  heap_[pos] = heap_[last];
+                  heap_.pop_back();
+                  restore(pos);
+              } else {
+                  heap_.pop_back();
+              }
+          }
+
+          // Moves a scheduled node after its deadline has changed.
+          void update(Node* node) noexcept {
+              auto pos = node->hook().pos;
+              heap_[pos].expire = node->getExpire();
+              restore(pos);
+          }
+
+          // Unlinks up to `budget` nodes whose deadline is at or before `now`,
+          // earliest first, and passes each to fn, which may destroy it.
+          // Returns the number of nodes expired.
+          template<typename F>
+          size_t expire(long now, size_t budget, F&& fn) {
+              auto expired = size_t{0};
+              while (expired < budget && !heap_.empty() && heap_.front().expire <= now) {
+                  auto node = heap_.front().node;
+                  remove(node);
+                  fn(node);
+                  ++expired;
+              }
+              if (expired) shrink();
+              return expired;
+          }
+
+          // Passes the scheduled nodes to fn, earliest deadline first, for
+          // as long as fn returns true. Only the frontier of the heap below
+          // the nodes visited is ordered, so the first k cost O(k log k).
+          template<typename F>
+          void visit(F&& fn) const {
+              if (heap_.empty()) return;
+              auto later = [this](size_t a, size_t b) { return heap_[a].expire > heap_[b].expire; };
+              auto frontier = std::vector<size_t>{0};
+              while (!frontier.empty()) {
+                  std::pop_heap(frontier.begin(), frontier.end(), later);
+                  auto pos = frontier.back();
+                  frontier.pop_back();
+                  if (!fn(heap_[pos].node)) return;
+                  for (auto child = 2 * pos + 1; child <= 2 * pos + 2 && child < heap_.size(); ++child) {
+                      frontier.push_back(child);
+                      std::push_heap(frontier.begin(), frontier.end(), later);
+                  }
+              }
+          }
+
+          // Counts the scheduled nodes whose deadline is at or before `now`.
+          // They form a subtree at the root of the heap, which is walked in
+          // place, so the count costs O(k) and allocates nothing.
+          size_t count_due(long now) const noexcept {
+              auto due = [this, now](size_t pos) { return pos < heap_.size() && heap_[pos].expire <= now; };
+              if (!due(0)) return 0;
+              auto count = size_t{0};
+              auto pos = size_t{0};
+              for (;;) {
+                  ++count;
+                  if (due(2 * pos + 1)) { pos = 2 * pos + 1; continue; }
+                  if (due(2 * pos + 2)) { pos = 2 * pos + 2; continue; }
+                  // the subtree under pos is done: go on with the nearest
+                  // right sibling still due on the way back to the root
+                  for (;;) {
+                      if (pos == 0) return count;
+                      if (pos % 2 == 1 && due(pos + 1)) { ++pos; break; }
+                      pos = (pos - 1) / 2;
+                  }
+              }
+          }
+
+          size_t size() const noexcept { return heap_.size(); }
+          void clear() noexcept { std::vector<entry>().swap(heap_); }
+
+          ExpiryFootprint footprint() const noexcept {
+              return ExpiryFootprint{heap_.size(), heap_.capacity(), heap_.capacity() * sizeof(entry)};
+          }
+
+      private:
+          struct entry {
+              long expire;
+              Node* node;
+          };
+
+          // below this many slots the heap array is never reallocated to shrink
+          static constexpr size_t min_reserve = 64;
+
+          // remove() is noexcept and cannot reallocate, so the array is
+          // trimmed here, on the next insert() or expire(), instead
+          void shrink() {
+              if (heap_.capacity() <= min_reserve || heap_.size() * 4 >= heap_.capacity()) return;
+              auto smaller = std::vector<entry>{};
+              smaller.reserve(heap_.size() * 2 > min_reserve ? heap_.size() * 2 : min_reserve);
+              smaller.assign(heap_.begin(), heap_.end());
+              heap_.swap(smaller);
+          }
+
+          void place(size_t pos, const entry& e) noexcept {
+              heap_[pos] = e;
+              e.node->hook().pos = pos;
+          }
+
+          void restore(size_t pos) noexcept {
+              if (pos > 0 && heap_[pos].expire < heap_[(pos - 1) / 2].expire)
+                  sift_up(pos);
+              else
+                  sift_down(pos);
+          }
+
+          void sift_up(size_t pos) noexcept {
+              auto e = heap_[pos];
+              while (pos > 0) {
+                  auto parent = (pos - 1) / 2;
+                  if (heap_[parent].expire <= e.expire) break;
+                  place(pos, heap_[parent]);
+                  pos = parent;
+              }
+              place(pos, e);
+          }
+
+          void sift_down(size_t pos) noexcept {
+              auto e = heap_[pos];
+              auto n = heap_.size();
+              while (true) {
+                  auto child = 2 * pos + 1;
+                  if (child >= n) break;
+                  if (child + 1 < n && heap_[child + 1].expire < heap_[child].expire) ++child;
+                  if (e.expire <= heap_[child].expire) break;
+                  place(pos, heap_[child]);
+                  pos = child;
+              }
+              place(pos, e);
+          }
+
+          std::vector<entry> heap_;
+      };
+  };
+
+  //
+  // Struct: WheelExpiry
+  // Usage: ExpiringMap<K, V, WheelExpiry> emap;
+  // ----------------------------------------------------------------
+  // This expiry policy keeps deadlines in a hierarchical timing wheel with a
+  // resolution of one millisecond. Each level has 64 slots and covers 64 times
+  // the span of the level below it, with enough levels for any non-negative
+  // deadline. Scheduling and removing are O(1), and expiring is amortized O(1)
+  // per entry since an entry cascades down at most once per level. Empty slots
+  // are skipped with per-level occupancy bitmaps, so idle periods cost nothing.
+  // Slots are intrusive doubly-linked lists threaded through the nodes.
+  struct WheelExpiry {
+      template<typename Node>
+      struct hook {
+          Node* prev = nullptr;
+          Node* next = nullptr;
+          int slot = -1;
+      };
+
+      template<typename Node>
+      class index {
+      public:
+          void insert(Node* node) {
+              ++size_;
+              if (node->getExpire() <= now_)
+                  link(node, due_slot);
+              else
+                  place(node);
+          }
+
+          void remove(Node* node) noexcept {
+              if (node->hook().slot < 0) return;
+              unlink(node);
+              --size_;
+          }
+
+          // Moves a scheduled node after its deadline has changed.
+          void update(Node* node) noexcept {
+              unlink(node);
+              if (node->getExpire() <= now_)
+                  link(node, due_slot);
+              else
+                  place(node);
+          }
+
+          // Advances the wheel towards `now`, unlinking the nodes whose
+          // deadline is at or before `now` and passing each to fn, which may
+          // destroy it. At most `budget` nodes are touched, counting both the
+          // ones expired and the ones cascaded to a lower level; whatever is
+          // left stays in place for the next call. Returns the number of nodes
+          // expired.
+          template<typename F>
+          size_t expire(long now, size_t budget, F&& fn) {
+              auto expired = size_t{0};
+              auto work = size_t{0};
+              while (work < budget) {
+                  if (auto node = heads_[due_slot]) {
+                      unlink(node);
+                      --size_;
+                      fn(node);
+                      ++expired;
+                      ++work;
+                      continue;
+                  }
+                  // the slots under the wheel's current time are due to be
+                  // refiled, highest level first
+                  for (auto level = levels - 1; level >= 0 && work < budget; --level) {
+                      auto slot = level * slots + slot_of(now_, level);
+                      while (heads_[slot] && work < budget) {
+                          auto node = heads_[slot];
+                          unlink(node);
+                          if (node->getExpire() <= now_) link(node, due_slot);
+                          else place(node);
+                          ++work;
+                      }
+                  }
+                  if (work >= budget || heads_[due_slot]) continue;
+                  if (now_ >= now) break;
+                  now_ = size_ ? std::min(next_event(), now) : now;
+              }
+              return expired;
+          }
+
+          // Passes the scheduled nodes to fn, earliest deadline first, for
+          // as long as fn returns true. Every slot holds deadlines from a
+          // known range, so slots are opened in order of the earliest
+          // deadline they can hold and only their nodes are ordered: the
+          // first k nodes cost O(k log k) plus the size of the slots opened.
+          template<typename F>
+          void visit(F&& fn) const {
+              struct pending {
+                  long at;     // the node's deadline, or the slot's earliest
+                  Node* node;  // nullptr for a slot not opened yet
+                  int slot;
+              };
+              auto later = [](const pending& a, const pending& b) { return a.at > b.at; };
+              auto queue = std::vector<pending>{};
+              if (heads_[due_slot]) queue.push_back({LONG_MIN, nullptr, due_slot});
+              for (auto level = 0; level < levels; ++level) {
+                  auto base = level == levels - 1 ? 0 : now_ & ~(span(level + 1) - 1);
+                  for (auto mask = occupied_[level]; mask; mask &= mask - 1) {
+                      auto slot = lowest_bit(mask);
+                      queue.push_back({base + slot * span(level), nullptr, level * slots + slot});
+                  }
+              }
+              std::make_heap(queue.begin(), queue.end(), later);
+              while (!queue.empty()) {
+                  std::pop_heap(queue.begin(), queue.end(), later);
+                  auto next = queue.back();
+                  queue.pop_back();
+                  if (next.node) {
+                      if (!fn(next.node)) return;
+                      continue;
+                  }
+                  for (auto node = heads_[next.slot]; node; node = node->hook().next) {
+                      queue.push_back({node->getExpire(), node, 0});
+                      std::push_heap(queue.begin(), queue.end(), later);
+                  }
+              }
+          }
+
+          // Counts the scheduled nodes whose deadline is at or before `now`,
+          // in no order and without allocating: only the slots whose
+          // earliest deadline is at or before `now` are scanned.
+          size_t count_due(long now) const noexcept {
+              auto count = size_t{0};
+              auto scan = [this, now, &count](int slot) {
+                  for (auto node = heads_[slot]; node; node = node->hook().next)
+                      if (node->getExpire() <= now) ++count;
+              };
+              scan(due_slot);
+              for (auto level = 0; level < levels; ++level) {
+                  auto base = level == levels - 1 ? 0 : now_ & ~(span(level + 1) - 1);
+                  for (auto mask = occupied_[level]; mask; mask &= mask - 1) {
+                      auto slot = lowest_bit(mask);
+                      if (base + slot * span(level) <= now) scan(level * slots + slot);
+                  }
+              }
+              return count;
+          }
+
+          size_t size() const noexcept { return size_; }
+
+          void clear() noexcept {
+              for (auto& head : heads_) head = nullptr;
+              for (auto& mask : occupied_) mask = 0;
+              size_ = 0;
+          }
+
+          // the slots are part of the index object, and the lists live in the nodes
+          ExpiryFootprint footprint() const noexcept {
+              return ExpiryFootprint{size_, size_, 0};
+          }
+
+      private:
+          static constexpr int bits = 6;
+          static constexpr int slots = 1 << bits;
+          static constexpr int levels = (63 + bits - 1) / bits;
+          static constexpr int due_slot = levels * slots;
+
+          static constexpr long span(int level) noexcept { return 1L << (bits * level); }
+          static int slot_of(long time, int level) noexcept {
+              return static_cast<int>((time >> (bits * level)) & (slots - 1));
+          }
+          static std::uint64_t bit(int slot) noexcept { return std::uint64_t{1} << (slot % slots); }
+
+          void link(Node* node, int slot) noexcept {
+              auto& h = node->hook();
+              h.slot = slot;
+              h.prev = nullptr;
+              h.next = heads_[slot];
+              if (h.next) h.next->hook().prev = node;
+              heads_[slot] = node;
+              if (slot < due_slot) occupied_[slot / slots] |= bit(slot);
+          }
+
+          void unlink(Node* node) noexcept {
+              auto& h = node->hook();
+              if (h.prev) h.prev->hook().next = h.next;
+              else heads_[h.slot] = h.next;
+              if (h.next) h.next->hook().prev = h.prev;
+              if (!heads_[h.slot] && h.slot < due_slot)
+                  occupied_[h.slot / slots] &= ~bit(h.slot);
+              h.slot = -1;
+          }
+
+          // Files a node (deadline after now_) under the highest level at which
+          // its deadline still differs from the wheel's current time. The slot
+          // always lies ahead of the current time at that level.
+          void place(Node* node) noexcept {
+              auto expire = node->getExpire();
+              auto level = highest_bit(static_cast<std::uint64_t>(expire ^ now_)) / bits;
+              link(node, level * slots + slot_of(expire, level));
+          }
+
+          // Returns the earliest time after now_ at which a slot has to be
+          // refiled.
+          long next_event() const noexcept {
+              auto next = LONG_MAX;
+              for (auto level = 0; level < levels; ++level) {
+                  auto slot = slot_of(now_, level);
+                  auto mask = slot == slots - 1 ? 0 : occupied_[level] & (~std::uint64_t{0} << (slot + 1));
+                  if (!mask) continue;
+                  auto base = level == levels - 1 ? 0 : now_ & ~(span(level + 1) - 1);
+                  next = std::min(next, base + lowest_bit(mask) * span(level));
+              }
+              return next;
+          }
+
+          Node* heads_[due_slot + 1] = {};
+          std::uint64_t occupied_[levels] = {};
+          long now_ = 0;
+          size_t size_ = 0;
+      };
+  };
+
+  //
+  // Class: PinnedValue
+  // Usage: if (auto value = emap.lookup(key)) use(*value);
+  // ----------------------------------------------------------------
+  // This template is a read-only view of a value inside one of the thread-safe
+  // maps, as returned by their lookup(). It holds whatever keeps the value in
+  // place (a shard lock or an epoch guard) until it is destroyed, so the value
+  // is read where it lives instead of being copied out. Keep it short-lived,
+  // and release it before calling into the same map again.
+  template<typename V, typename Pin>
+  class PinnedValue {
+  public:
+      PinnedValue(Pin&& pin, const V* value) noexcept
+        : pin_{std::move(pin)}, value_{value} {}
+      PinnedValue(PinnedValue&&) = default;
+      PinnedValue& operator=(PinnedValue&&) = default;
+
+      explicit operator bool() const noexcept { return value_ != nullptr; }
+      const V& operator*() const noexcept { return *value_; }
+      const V* operator->() const noexcept { return value_; }
+      const V* get() const noexcept { return value_; }
+
+  private:
+      Pin pin_;
+      const V* value_;
+  };
+
+  //
+  // Class: KeyStream
+  // Usage: for (const auto& key : emap.key_stream()) use(key);
+  // ----------------------------------------------------------------
+  // This template lists the live keys of a map ordered by expiration time, as
+  // keys() does, without copying them. It holds a deadline and a pointer per
+  // key, arranged as a heap in O(n), and orders them lazily: each step pops
+  // the next key in O(log n), so stopping after the first k keys costs
+  // O(n + k log n) rather than a full sort. The keys are read in place, so
+  // the map must not be modified while the stream is in use.
+  template<typename K>
+  class KeyStream {
+  public:
+      class iterator {
+      public:
+          using iterator_category = std::input_iterator_tag;
+          using value_type = K;
+          using difference_type = std::ptrdiff_t;
+          using pointer = const K*;
+          using reference = const K&;
+
+          explicit iterator(KeyStream* stream = nullptr) noexcept : stream_{stream} {}
+          const K& operator*() const noexcept { return *stream_->heap_.front().second; }
+          const K* operator->() const noexcept { return stream_->heap_.front().second; }
+          iterator& operator++() { stream_->pop(); return *this; }
+          bool operator==(const iterator& other) const noexcept { return done() == other.done(); }
+          bool operator!=(const iterator& other) const noexcept { return done() != other.done(); }
+
+      private:
+          bool done() const noexcept { return !stream_ || stream_->heap_.empty(); }
+          KeyStream* stream_;
+      };
+
+      // entries are (deadline, key) pairs of the live keys, in any order
+      explicit KeyStream(std::vector<std::pair<long, const K*>> entries)
+        : heap_{std::move(entries)} {
+          std::make_heap(heap_.begin(), heap_.end(), later);
+      }
+
+      iterator begin() noexcept { return iterator(this); }
+      iterator end() noexcept { return iterator(); }
+      bool empty() const noexcept { return heap_.empty(); }
+      size_t size() const noexcept { return heap_.size(); }
+
+  private:
+      // the heap keeps the earliest deadline, then the smallest key, in front
+      static bool later(const std::pair<long, const K*>& a, const std::pair<long, const K*>& b) {
+          return (a.first != b.first)? a.first > b.first : *b.second < *a.second;
+      }
+
+      void pop() {
+          std::pop_heap(heap_.begin(), heap_.end(), later);
+          heap_.pop_back();
+      }
+
+      std::vector<std::pair<long, const K*>> heap_;
+  };
+
   //
   // Class: ExpiringMap
   // Usage: ExpiringMap<K, V> emap;
   // ----------------------------------------------------------------
   // This template provides an expiring map that its keys with corresponding
-  // values can expire after a specific duration (in milliseconds)
-  template<typename K, typename V>
-  class ExpiringMap {
+  // values can expire after a specific duration (in milliseconds).
+  // The Expiry policy selects how deadlines are tracked: HeapExpiry (default)
+  // or WheelExpiry for O(1) scheduling with large numbers of keys. The Clock
+  // policy (see ExpiryClock.h) supplies the time and is read once per
+  // operation; the default SteadyClock is monotonic, so adjusting the system
+  // time neither expires entries early nor keeps them alive. The Evict policy
+  // (see EvictionPolicy.h) picks the live elements to evict when the map is
+  // bounded with set_capacity(); the default NoEviction leaves it unbounded.
+  // The Stats policy (see ExpiryStats.h) counts what the operations do for
+  // stats(); the default NoStats costs nothing. The recorder is a base so
+  // that NoStats takes no room.
+  template<typename K, typename V, typename Expiry = HeapExpiry, typename Clock = SteadyClock,
+           typename Evict = NoEviction, typename Stats = NoStats>
+  class ExpiringMap : private Stats::recorder {
   private:
       class Item; // forward declaration
-      struct ItemCompare {
-      	bool operator()(std::weak_ptr<Item> lhs, std::weak_ptr<Item> rhs) {
-      		return lhs.lock()->getExpire() > rhs.lock()->getExpire();
-      	}
-      };
+      template<typename, typename, typename, typename, typename> friend class ConcurrentExpiringMap;
 
   public:
+      class const_iterator; // defined below
+      using iterator = const_iterator;
+
       ExpiringMap() = default;
-      //NOTE: may require the rule of five (especially for deep-copy)
+      // The expiry index points into the map's nodes, so a copy has to
+      // re-index its own nodes and a moved-from map is left empty.
+      ExpiringMap(const ExpiringMap& other);
+      ExpiringMap(ExpiringMap&& other) noexcept;
+      ExpiringMap& operator=(const ExpiringMap& other);
+      ExpiringMap& operator=(ExpiringMap&& other) noexcept;
+      ~ExpiringMap() = default;
 
       //
       // Member function: put
@@ -40,6 +630,46 @@ namespace pj4dev {
       // already existed in the map, it will be updated and overwritten. No values
       // are returned by this function.
       void put(const K& key, const V& value, long ms);
+      void put(K&& key, V&& value, long ms);
+
+      //
+      // Member function: try_emplace
+      // Usage: emap.try_emplace(key, duration, args...);
+      // ----------------------------------------------------------------
+      // This function inserts a key whose value is constructed in place from
+      // args, unless the key already exists and has not expired, in which case
+      // nothing is touched (and an rvalue key is not moved from). Returns
+      // whether the key was inserted.
+      template<typename... Args>
+      bool try_emplace(const K& key, long ms, Args&&... args) { return emplace_key(key, ms, std::forward<Args>(args)...); }
+      template<typename... Args>
+      bool try_emplace(K&& key, long ms, Args&&... args) { return emplace_key(std::move(key), ms, std::forward<Args>(args)...); }
+
+      //
+      // Member function: insert_or_assign
+      // Usage: emap.insert_or_assign(key, value, duration);
+      // ----------------------------------------------------------------
+      // This function works like put() and forwards the key and the value, so
+      // rvalues are moved into the map rather than copied. Returns whether the
+      // key was inserted rather than a live one overwritten.
+      template<typename M>
+      bool insert_or_assign(const K& key, M&& value, long ms) { return assign_key(key, std::forward<M>(value), ms); }
+      template<typename M>
+      bool insert_or_assign(K&& key, M&& value, long ms) { return assign_key(std::move(key), std::forward<M>(value), ms); }
+
+      //
+      // Member function: put_batch
+      // Usage: emap.put_batch(entries.begin(), entries.end(), duration);
+      // ----------------------------------------------------------------
+      // This function puts a range of (key, value) pairs with one duration, as
+      // put() would one at a time, but reads the clock once, visits the keys
+      // in order so that a key next to the previous one is reached without a
+      // descent, and purges expired elements once for the whole batch (with
+      // the expiry budget scaled by the batch size). A key given twice ends
+      // up with its last value. The range is traversed twice, so It must be
+      // a forward iterator.
+      template<typename It>
+      void put_batch(It first, It last, long ms);
 
       //
       // Member function: get
@@ -47,17 +677,79 @@ namespace pj4dev {
       // ----------------------------------------------------------------
       // This function retrieves a value from the given key. If the key does not
       // exist in the expring map or it has already expired, it will return
-      // the default value (zero or null).
+      // the default value (zero or null). Through a const reference it only
+      // reads, so readers may share a lock; otherwise it records the access
+      // in the eviction policy and, with a bounded expiry budget, purges up
+      // to that many expired elements on the way.
       V get(const K& key) const;
+      V get(const K& key);
+
+      //
+      // Member function: lookup
+      // Usage: if (auto value = emap.lookup(key)) use(*value);
+      // ----------------------------------------------------------------
+      // This function returns a pointer to the value of the given key, or
+      // nullptr if the key does not exist or has already expired, so large
+      // values can be read without copying them. It purges nothing, and
+      // through a const reference it only reads, as get() does; the pointer
+      // stays valid until the key is overwritten or removed, which put(),
+      // erase(), clear(), expire() and a non-const get() with a bounded
+      // expiry budget may do.
+      const V* lookup(const K& key) const;
+      const V* lookup(const K& key);
+
+      //
+      // Member function: get_batch
+      // Usage: emap.get_batch(keys.begin(), keys.end(), values.data());
+      // ----------------------------------------------------------------
+      // This function writes the value of each key in the range, or the
+      // default value, to the corresponding element of out, which must have
+      // room for them all. Like put_batch(), it reads the clock once and
+      // visits the keys in order. Like get(), it only reads through a const
+      // reference.
+      template<typename It>
+      void get_batch(It first, It last, V* out) const;
+      template<typename It>
+      void get_batch(It first, It last, V* out);
 
       //
       // Member function: keys
       // Usage: auto keys = emap.keys();
       // ----------------------------------------------------------------
       // This function returns a vector of keys which are still valid in the expiring
-      // map at the partucular point of time.
+      // map at the partucular point of time, ordered by their expiration time.
       std::vector<K> keys() const;
 
+      //
+      // Member function: key_stream
+      // Usage: for (const auto& key : emap.key_stream()) use(key);
+      // ----------------------------------------------------------------
+      // This function returns the keys of keys() as a KeyStream, which reads
+      // them in place and orders them as they are consumed.
+      KeyStream<K> key_stream() const;
+
+      //
+      // Member function: begin, end
+      // Usage: for (const auto& entry : emap) use(entry.first, entry.second);
+      // ----------------------------------------------------------------
+      // These functions iterate over the live elements in key order, as
+      // (key, value) pairs of references, in a single pass over the map. The
+      // time is read once, by begin(), and elements that have expired by then
+      // are skipped as the iterator reaches them; nothing is purged. The map
+      // must not be modified while iterating.
+      const_iterator begin() const;
+      const_iterator end() const;
+
+      //
+      // Member function: for_each_live
+      // Usage: emap.for_each_live([](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with the key and the value of every live
+      // element, in key order, reading the time once; it is the loop that
+      // begin() and end() spell out.
+      template<typename F>
+      void for_each_live(F&& fn) const;
+
       //
       // Member function: left
       // Usage: auto timeLeft = emap.left(key);
@@ -67,133 +759,929 @@ namespace pj4dev {
       // it will return zero.
       long left(const K& key) const;
 
+      //
+      // Member function: next_expiry
+      // Usage: auto timeLeft = emap.next_expiry();
+      // ----------------------------------------------------------------
+      // This function returns the remaining time (in milliseconds) of the
+      // element that expires first, or -1 if no element is live. It asks the
+      // expiry index instead of scanning the map.
+      long next_expiry() const;
+
+      //
+      // Member function: expiring_within
+      // Usage: emap.expiring_within(duration, [](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with the key and the value of each live element
+      // that expires within the given duration (in milliseconds), soonest
+      // first, stopping after limit elements, and returns how many it visited.
+      // The expiry index is walked in deadline order and only the elements
+      // visited are ordered, so the soonest k cost O(k log k) however large
+      // the map is. fn must not modify the map.
+      template<typename F>
+      size_t expiring_within(long ms, F&& fn, size_t limit = SIZE_MAX) const;
+
+      //
+      // Member function: touch
+      // Usage: emap.touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function resets the remaining time of a live key to the given
+      // duration (in milliseconds) without touching its value, as sliding
+      // expiration needs. The deadline moves within the expiry index, which
+      // costs O(log n) with HeapExpiry and O(1) with WheelExpiry and never
+      // allocates. Returns false if the key does not exist or has expired.
+      bool touch(const K& key, long ms);
+
+      //
+      // Member function: get_and_touch
+      // Usage: auto value = emap.get_and_touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function returns the value of a live key like get() and resets
+      // its remaining time like touch(), with a single lookup.
+      V get_and_touch(const K& key, long ms);
+
       //
       // Member function: erase
       // Usage: emap.erase(key);
       // ----------------------------------------------------------------
       // This function deletes a key and its associated value from the expiring map.
       // It will have no effects if the key doesn't exist in the map.
-      void erase(const K& key) noexcept;
+      void erase(const K& key);
+
+      //
+      // Member function: erase_batch
+      // Usage: auto n = emap.erase_batch(keys.begin(), keys.end());
+      // ----------------------------------------------------------------
+      // This function deletes every key in the range, visiting them in order,
+      // and returns how many of them were in the map.
+      template<typename It>
+      size_t erase_batch(It first, It last);
 
       //
       // Member function: clear
       // Usage: emap.clear();
       // ----------------------------------------------------------------
       // This function removes all elements in the expiring map.
-      void clear() noexcept;
+      void clear();
 
       //
       // Member function: size
       // Usage: auto s = emap.size();
       // ----------------------------------------------------------------
       // This function returns the size of non-expired key-value elements in
-      // the expiring map at the particular point of time.
-      size_t size() const noexcept;
+      // the expiring map at the particular point of time. It purges nothing:
+      // the elements that have expired are counted in the expiry index, in
+      // no order and without allocating, and subtracted.
+      size_t size() const;
+
+      //
+      // Member function: expire
+      // Usage: auto n = emap.expire(budget);
+      // ----------------------------------------------------------------
+      // This function removes up to `budget` expired elements, earliest first,
+      // and returns how many were removed. It lets a maintenance thread (see
+      // ExpiryReaper) drain expired entries in bounded steps; the map is not
+      // thread-safe, so the caller provides the locking.
+      size_t expire(size_t budget = expire_all);
+
+      //
+      // Member function: set_expiry_budget
+      // Usage: emap.set_expiry_budget(64);
+      // ----------------------------------------------------------------
+      // This function sets how many expired elements a put() or get() may
+      // purge on the way. By default (expire_all) put() purges everything
+      // that is due, which can stall one unlucky put() when many keys expire
+      // at once. A smaller budget spreads that backlog over the following
+      // operations, each paying for at most `budget` elements; 0 leaves expiry
+      // to expire() alone. Const operations never purge.
+      void set_expiry_budget(size_t budget) noexcept { expiry_budget_ = budget; }
+
+      //
+      // Member function: expiry_footprint
+      // Usage: auto fp = emap.expiry_footprint();
+      // ----------------------------------------------------------------
+      // This function reports the memory held by the expiry index, including
+      // elements that have expired but have not been purged yet.
+      ExpiryFootprint expiry_footprint() const noexcept { return expired_queue_.footprint(); }
+
+      //
+      // Member function: set_eviction_listener
+      // Usage: emap.set_eviction_listener([](std::vector<Eviction<K, V>>& evicted) { ... });
+      // ----------------------------------------------------------------
+      // This function sets the function to which elements are handed as they
+      // leave the map, with their key, value and reason: expired, erased or
+      // replaced. The elements that leave during one call of the map, such as
+      // a purge of expired elements, are delivered together at the end of
+      // that call, when the map is consistent again and may be used from the
+      // listener. Without a listener, which is the default, nothing is
+      // recorded. A copy of the map starts without one, and assigning to a
+      // map keeps its own. Destroying or assigning to a map reports nothing.
+      void set_eviction_listener(EvictionListener<K, V> listener) {
+          eviction_listener_ = std::move(listener);
+          track_evictions_ = static_cast<bool>(eviction_listener_);
+      }
+
+      //
+      // Member function: set_capacity
+      // Usage: emap.set_capacity(100000);
+      // ----------------------------------------------------------------
+      // This function bounds the number of elements. A put() that takes the
+      // map over the bound first purges expired elements, earliest first,
+      // but no more than it is over the bound and no more than the expiry
+      // budget, so a large expired backlog does not stall it; then it evicts
+      // elements chosen by the Evict policy, which are reported to the
+      // eviction listener with EvictionReason::capacity, or ::expired for a
+      // victim that had expired.
+      // Lowering the bound evicts at once. With an eviction policy, reads
+      // (get(), lookup(), get_batch()) on a non-const map record the access
+      // in the policy, so even they must not run concurrently; through a
+      // const reference they record nothing and do not count as uses.
+      // SIZE_MAX, the default, removes the bound.
+      void set_capacity(size_t capacity);
+      size_t capacity() const noexcept { return capacity_; }
+
+      //
+      // Member function: set_weigher
+      // Usage: emap.set_weigher([](const K& key, const V& value) { return value.capacity(); });
+      // ----------------------------------------------------------------
+      // This function sets the function that reports the bytes an element
+      // holds outside its node (see Weigher), for memory_usage() and
+      // set_max_bytes(). It is called when an element is stored and again
+      // when it leaves, so it must give the same answer for the same key and
+      // value in between. Without a weigher the payload counts as zero.
+      void set_weigher(Weigher<K, V> weigher);
+
+      //
+      // Member function: set_max_bytes
+      // Usage: emap.set_max_bytes(64 << 20);
+      // ----------------------------------------------------------------
+      // This function bounds the bytes held by the elements: their nodes
+      // plus the payload the weigher reports. It evicts as set_capacity()
+      // does, and the two bounds can be combined. The indexes' own arrays
+      // are not counted, as they do not shrink by evicting one element.
+      // SIZE_MAX, the default, removes the bound.
+      void set_max_bytes(size_t bytes);
+      size_t max_bytes() const noexcept { return max_bytes_; }
+
+      //
+      // Member function: memory_usage
+      // Usage: auto mu = emap.memory_usage();
+      // ----------------------------------------------------------------
+      // This function reports the memory held by the map, broken down into
+      // nodes, index arrays and payload, in O(1). A node is counted as the
+      // allocation std::map makes for it, its header included, and expired
+      // elements count until they are purged.
+      MemoryUsage memory_usage() const noexcept;
+
+      //
+      // Member function: stats
+      // Usage: auto st = emap.stats();
+      // ----------------------------------------------------------------
+      // This function returns what the map's operations did since it was
+      // constructed (see MapStats): reads by outcome, writes, erases,
+      // purges by batch size, evictions and the latency of single-key puts
+      // and gets, with the size of the expiry index. It needs the
+      // CountingStats policy. The counts are kept per thread and read
+      // without stopping the writers, so a snapshot taken while the map is
+      // in use may be a few operations behind.
+      MapStats stats() const;
 
   private:
-      class Item {
+      //
+      // An Item lives inside its internal_map_ node for the key's whole
+      // lifetime and embeds the hooks of the expiry and eviction indexes, so
+      // one allocation covers all three and erasing a key unlinks it from the
+      // indexes directly. The key itself is stored once, in the map node,
+      // which the Item keeps an iterator to, so that an element the indexes
+      // hand out is erased without another descent. The eviction hook is a
+      // base so that NoEviction's empty one takes no room.
+      class Item : private Evict::template hook<Item> {
       public:
+          using hook_type = typename Expiry::template hook<Item>;
+          using evict_hook_type = typename Evict::template hook<Item>;
+          using node_type = typename std::map<K, Item>::iterator;
           Item() = default;
-          Item(const K& k, const V& v, long exp)
-            : key_{k}, value_{v}, expire_{exp}{}
-          const K& getKey() const noexcept { return key_; }
-  	      const V& getValue() const noexcept { return value_; }
+          template<typename... Args>
+          Item(long exp, Args&&... args)
+            : value_(std::forward<Args>(args)...), expire_{exp}{}
+          Item(const Item& other)
+            : evict_hook_type{}, value_{other.value_}, expire_{other.expire_}{}
+          Item& operator=(const Item&) = delete;
+          const K& getKey() const noexcept { return node_->first; }
+          const V& getValue() const noexcept { return value_; }
           long getExpire() const noexcept { return expire_; }
+          void setExpire(long exp) noexcept { expire_ = exp; }
+          hook_type& hook() noexcept { return hook_; }
+          evict_hook_type& evict_hook() noexcept { return *this; }
+          node_type node() const noexcept { return node_; }
+          void bind(node_type node) noexcept { node_ = node; }
+          template<typename M>
+          void assign(M&& v, long exp) { value_ = std::forward<M>(v); expire_ = exp; }
+          // sets the value and the deadline, and returns the value replaced
+          template<typename M>
+          V exchange(M&& v, long exp) {
+              auto old = std::exchange(value_, V(std::forward<M>(v)));
+              expire_ = exp;
+              return old;
+          }
+          V takeValue() { return std::move(value_); }
       private:
-  	      K key_;
-  	      V value_;
-  	      long expire_;
+          node_type node_{};
+          V value_;
+          long expire_;
+          hook_type hook_;
       };
 
-      mutable std::priority_queue<std::weak_ptr<Item>, std::vector<std::weak_ptr<Item>>, ItemCompare> expired_queue_;
-      mutable std::map<K, std::shared_ptr<Item>> internal_map_;
+      // one node of internal_map_ as allocated: libstdc++'s node header
+      // (colour and three links) followed by the key and the Item
+      static constexpr size_t node_bytes = allocation_size(4 * sizeof(void*) + sizeof(std::pair<const K, Item>));
+
+      typename Expiry::template index<Item> expired_queue_;
+      typename Evict::template index<Item> eviction_queue_;
+      std::map<K, Item> internal_map_;
+      size_t expiry_budget_ = expire_all;
+      size_t capacity_ = SIZE_MAX;
+      size_t max_bytes_ = SIZE_MAX;
+      Weigher<K, V> weigher_;
+      size_t payload_ = 0; // the weigher's total over the elements
+      EvictionListener<K, V> eviction_listener_;
+      std::vector<Eviction<K, V>> evictions_;
+      bool track_evictions_ = false; // a listener is set, or the owner drains evictions_
+
+      using node_iterator = typename std::map<K, Item>::iterator;
+      using const_node_iterator = typename std::map<K, Item>::const_iterator;
 
-      static long current_time() noexcept {
-  	     return std::chrono::duration_cast<std::chrono::milliseconds>(
-  		       std::chrono::system_clock::now().time_since_epoch()
-  	     ).count();
+      static long current_time() noexcept { return Clock::now(); }
+      typename Stats::recorder& recorder() noexcept { return *this; }
+      const typename Stats::recorder& recorder() const noexcept { return *this; }
+      // counts a read of a key that was absent, live or expired
+      void count_read(bool found, bool live) const noexcept {
+          recorder().count(live ? StatsCounter::hits : found ? StatsCounter::expired_reads : StatsCounter::misses);
+      }
+      size_t clearExpired(long now, size_t budget);
+      size_t count_expired(long now) const;
+      void reset() noexcept;
+      void trim(long now);
+      void bound_eviction_queue();
+      void unlink(Item& item) noexcept {
+          expired_queue_.remove(&item);
+          eviction_queue_.remove(&item);
+      }
+      void weighed(const Item& item) {
+          if (weigher_) payload_ += weigher_(item.getKey(), item.getValue());
+      }
+      bool over_bounds() const noexcept {
+          return internal_map_.size() > capacity_ || internal_map_.size() * node_bytes + payload_ > max_bytes_;
+      }
+      // how many elements over the bounds the map is, counting an excess of
+      // bytes in bare nodes
+      size_t overflow() const noexcept {
+          auto size = internal_map_.size();
+          auto over = size > capacity_ ? size - capacity_ : 0;
+          auto bytes = size * node_bytes + payload_;
+          if (bytes > max_bytes_) over = std::max(over, (bytes - max_bytes_ + node_bytes - 1) / node_bytes);
+          return over;
+      }
+      void evicted(Item& item, EvictionReason reason) {
+          if (weigher_) payload_ -= weigher_(item.getKey(), item.getValue());
+          if (track_evictions_) evictions_.push_back({item.getKey(), item.takeValue(), reason});
       }
-      void clearExpired() const;
+      // the new value is in place before the old one is weighed or reported,
+      // so a new value read from the old one is read intact, and a throw
+      // leaves the element and the accounting as they were
+      template<typename M>
+      void overwrite(Item& item, M&& value, long expire, EvictionReason reason) {
+          if (!weigher_ && !track_evictions_) {
+              item.assign(std::forward<M>(value), expire);
+              return;
+          }
+          auto old = item.exchange(std::forward<M>(value), expire);
+          if (weigher_) payload_ += weigher_(item.getKey(), item.getValue()) - weigher_(item.getKey(), old);
+          if (track_evictions_) evictions_.push_back({item.getKey(), std::move(old), reason});
+      }
+      void deliver_evictions();
+
+      template<typename KK, typename... Args>
+      bool emplace_key(KK&& key, long ms, Args&&... args);
+      template<typename KK, typename M>
+      bool assign_key(KK&& key, M&& value, long ms);
+      template<typename KK, typename M>
+      std::pair<node_iterator, bool> assign_at(node_iterator pos, KK&& key, M&& value, long expire, long curtime);
+      bool remove_key(const K& key);
+      std::vector<std::pair<long, const K*>> live_entries() const;
+      node_iterator seek(node_iterator hint, const K& key) { return seek_in(internal_map_, hint, key); }
+      const_node_iterator seek(const_node_iterator hint, const K& key) const { return seek_in(internal_map_, hint, key); }
+      using node_type = typename std::map<K, Item>::value_type;
+      const node_type* lookup_live(const K& key) const;
+      template<typename Map, typename It>
+      static It seek_in(Map& map, It hint, const K& key);
+      template<typename It, typename KeyOf>
+      std::vector<std::pair<It, size_t>> sorted_batch(It first, It last, KeyOf key_of) const;
+      template<typename KK, typename... Args>
+      node_iterator emplace_item(node_iterator hint, KK&& key, long expire, Args&&... args);
   };
 
-  template<typename K, typename V>
-  inline void ExpiringMap<K, V>::put(const K& key, const V& value, long ms) {
-      auto expired_time = current_time() + ms;
-      auto item = std::make_shared<Item>(key, value, expired_time);
-      auto res = internal_map_.find(key);
-      if (res != internal_map_.end()) {
-      	internal_map_.erase(res);
+  //
+  // Class: ExpiringMap::const_iterator
+  // ----------------------------------------------------------------
+  // A forward iterator over the elements of an ExpiringMap that were live at
+  // a given time. It dereferences to a (key, value) pair of references.
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  class ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::const_iterator {
+  public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<const K&, const V&>;
+      using difference_type = std::ptrdiff_t;
+      using pointer = void;
+      using reference = std::pair<const K&, const V&>;
+
+      const_iterator() = default;
+      reference operator*() const noexcept { return {pos_->first, pos_->second.getValue()}; }
+      const_iterator& operator++() noexcept { ++pos_; skip(); return *this; }
+      const_iterator operator++(int) noexcept { auto it = *this; ++*this; return it; }
+      bool operator==(const const_iterator& other) const noexcept { return pos_ == other.pos_; }
+      bool operator!=(const const_iterator& other) const noexcept { return pos_ != other.pos_; }
+
+  private:
+      friend class ExpiringMap;
+      using base = typename std::map<K, Item>::const_iterator;
+
+      const_iterator(base pos, base end, long now) noexcept : pos_{pos}, end_{end}, now_{now} { skip(); }
+      void skip() noexcept {
+          while (pos_ != end_ && pos_->second.getExpire() <= now_) ++pos_;
+      }
+
+      base pos_{};
+      base end_{};
+      long now_ = 0;
+  };
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::ExpiringMap(const ExpiringMap& other)
+    : Stats::recorder{}, internal_map_{other.internal_map_}, expiry_budget_{other.expiry_budget_}, capacity_{other.capacity_},
+      max_bytes_{other.max_bytes_}, weigher_{other.weigher_}, payload_{other.payload_} {
+      // the copy starts its recency and frequency history afresh
+      bound_eviction_queue();
+      for (auto node = internal_map_.begin(); node != internal_map_.end(); ++node) {
+          node->second.bind(node);
+          expired_queue_.insert(&node->second);
+          eviction_queue_.insert(&node->second);
       }
-      internal_map_.emplace(key, item);
-      expired_queue_.push(item);
-      clearExpired();
   }
 
-  template<typename K, typename V>
-  inline V ExpiringMap<K, V>::get(const K& key) const {
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::ExpiringMap(ExpiringMap&& other) noexcept
+    : Stats::recorder{std::move(other.recorder())},
+      expired_queue_{std::move(other.expired_queue_)},
+      eviction_queue_{std::move(other.eviction_queue_)},
+      internal_map_{std::move(other.internal_map_)},
+      expiry_budget_{other.expiry_budget_},
+      capacity_{other.capacity_},
+      max_bytes_{other.max_bytes_},
+      weigher_{std::move(other.weigher_)},
+      payload_{other.payload_},
+      eviction_listener_{std::move(other.eviction_listener_)},
+      track_evictions_{other.track_evictions_} {
+      other.reset();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline ExpiringMap<K, V, Expiry, Clock, Evict, Stats>& ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::operator=(const ExpiringMap& other) {
+      if (this != &other) {
+          auto copy = other;
+          copy.eviction_listener_ = std::move(eviction_listener_);
+          copy.track_evictions_ = track_evictions_;
+          *this = std::move(copy);
+      }
+      return *this;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline ExpiringMap<K, V, Expiry, Clock, Evict, Stats>& ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::operator=(ExpiringMap&& other) noexcept {
+      if (this != &other) {
+          reset();
+          expired_queue_ = std::move(other.expired_queue_);
+          eviction_queue_ = std::move(other.eviction_queue_);
+          internal_map_ = std::move(other.internal_map_);
+          expiry_budget_ = other.expiry_budget_;
+          capacity_ = other.capacity_;
+          max_bytes_ = other.max_bytes_;
+          weigher_ = std::move(other.weigher_);
+          payload_ = other.payload_;
+          eviction_listener_ = std::move(other.eviction_listener_);
+          track_evictions_ = other.track_evictions_;
+          other.reset();
+      }
+      return *this;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::put(const K& key, const V& value, long ms) {
+      assign_key(key, value, ms);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::put(K&& key, V&& value, long ms) {
+      assign_key(std::move(key), std::move(value), ms);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename KK, typename... Args>
+  inline bool ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::emplace_key(KK&& key, long ms, Args&&... args) {
+      auto started = recorder().start();
+      auto curtime = current_time();
+      auto res = internal_map_.lower_bound(key);
+      if (res != internal_map_.end() && !internal_map_.key_comp()(key, res->first)) {
+          if (res->second.getExpire() > curtime) {
+              recorder().put_latency(started);
+              return false;
+          }
+          overwrite(res->second, V(std::forward<Args>(args)...), curtime + ms, EvictionReason::expired);
+          expired_queue_.update(&res->second);
+          eviction_queue_.access(&res->second);
+      } else {
+          emplace_item(res, std::forward<KK>(key), curtime + ms, std::forward<Args>(args)...);
+      }
+      recorder().count(StatsCounter::inserts);
+      clearExpired(curtime, expiry_budget_);
+      trim(curtime);
+      recorder().put_latency(started);
+      deliver_evictions();
+      return true;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename KK, typename M>
+  inline bool ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::assign_key(KK&& key, M&& value, long ms) {
+      auto started = recorder().start();
+      auto curtime = current_time();
+      // one descent finds either the key or where it goes
+      auto pos = internal_map_.lower_bound(key);
+      auto inserted = assign_at(pos, std::forward<KK>(key), std::forward<M>(value), curtime + ms, curtime).second;
+      clearExpired(curtime, expiry_budget_);
+      trim(curtime);
+      recorder().put_latency(started);
+      deliver_evictions();
+      return inserted;
+  }
+
+  // Sets the key at pos, its lower bound, and returns the key's node and
+  // whether it was absent or expired. An existing node is updated in place
+  // and only moves within the expiry index.
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename KK, typename M>
+  inline auto ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::assign_at(node_iterator pos, KK&& key, M&& value, long expire, long curtime)
+      -> std::pair<node_iterator, bool> {
+      if (pos != internal_map_.end() && !internal_map_.key_comp()(key, pos->first)) {
+          auto inserted = pos->second.getExpire() <= curtime;
+          overwrite(pos->second, std::forward<M>(value), expire, inserted ? EvictionReason::expired : EvictionReason::replaced);
+          expired_queue_.update(&pos->second);
+          eviction_queue_.access(&pos->second);
+          recorder().count(inserted ? StatsCounter::inserts : StatsCounter::overwrites);
+          return {pos, inserted};
+      }
+      recorder().count(StatsCounter::inserts);
+      return {emplace_item(pos, std::forward<KK>(key), expire, std::forward<M>(value)), true};
+  }
+
+  // Returns the lower bound of key, given that every node before hint holds
+  // a smaller key. As a batch visits its keys in order, a key at or right
+  // after the previous one is found without descending the tree.
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename Map, typename It>
+  inline It ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::seek_in(Map& map, It hint, const K& key) {
+      auto less = map.key_comp();
+      if (hint == map.end() || !less(hint->first, key)) return hint;
+      if (++hint == map.end() || !less(hint->first, key)) return hint;
+      return map.lower_bound(key);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename It>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::put_batch(It first, It last, long ms) {
+      auto curtime = current_time();
+      auto batch = sorted_batch(first, last, [](const auto& entry) -> const K& { return entry.first; });
+      auto pos = internal_map_.begin();
+      for (const auto& entry : batch) {
+          const auto& key = entry.first->first;
+          pos = assign_at(seek(pos, key), key, entry.first->second, curtime + ms, curtime).first;
+      }
+      clearExpired(curtime, batch_budget(expiry_budget_, batch.size()));
+      trim(curtime);
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename It>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::get_batch(It first, It last, V* out) const {
+      auto curtime = current_time();
+      auto pos = internal_map_.cbegin();
+      for (const auto& entry : sorted_batch(first, last, [](const K& key) -> const K& { return key; })) {
+          pos = seek(pos, *entry.first);
+          auto found = pos != internal_map_.cend() && !internal_map_.key_comp()(*entry.first, pos->first);
+          auto live = found && pos->second.getExpire() > curtime;
+          count_read(found, live);
+          out[entry.second] = live ? pos->second.getValue() : V{};
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename It>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::get_batch(It first, It last, V* out) {
+      auto curtime = current_time();
+      auto batch = sorted_batch(first, last, [](const K& key) -> const K& { return key; });
+      if (expiry_budget_ != expire_all) clearExpired(curtime, batch_budget(expiry_budget_, batch.size()));
+      auto pos = internal_map_.begin();
+      for (const auto& entry : batch) {
+          pos = seek(pos, *entry.first);
+          auto found = pos != internal_map_.end() && !internal_map_.key_comp()(*entry.first, pos->first);
+          auto live = found && pos->second.getExpire() > curtime;
+          if (live) eviction_queue_.access(&pos->second);
+          count_read(found, live);
+          out[entry.second] = live ? pos->second.getValue() : V{};
+      }
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename It>
+  inline size_t ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::erase_batch(It first, It last) {
+      auto erased = size_t{0};
+      auto pos = internal_map_.begin();
+      for (const auto& entry : sorted_batch(first, last, [](const K& key) -> const K& { return key; })) {
+          pos = seek(pos, *entry.first);
+          if (pos != internal_map_.end() && !internal_map_.key_comp()(*entry.first, pos->first)) {
+              evicted(pos->second, EvictionReason::erased);
+              unlink(pos->second);
+              pos = internal_map_.erase(pos);
+              ++erased;
+          }
+      }
+      recorder().count(StatsCounter::erases, erased);
+      deliver_evictions();
+      return erased;
+  }
+
+  // the batch's iterators with their positions, ordered by key; ties keep
+  // the batch order, so a repeated key is applied in the order it was given in
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename It, typename KeyOf>
+  inline std::vector<std::pair<It, size_t>>
+  ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::sorted_batch(It first, It last, KeyOf key_of) const {
+      auto batch = std::vector<std::pair<It, size_t>>{};
+      batch.reserve(static_cast<size_t>(std::distance(first, last)));
+      for (size_t i = 0; first != last; ++first, ++i) batch.emplace_back(first, i);
+      auto less = internal_map_.key_comp();
+      std::sort(batch.begin(), batch.end(), [&less, &key_of](const auto& a, const auto& b) {
+          if (less(key_of(*a.first), key_of(*b.first))) return true;
+          return !less(key_of(*b.first), key_of(*a.first)) && a.second < b.second;
+      });
+      return batch;
+  }
+
+  // constructs the node's key and value in place; the key must be absent and
+  // belong right before hint
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename KK, typename... Args>
+  inline auto ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::emplace_item(node_iterator hint, KK&& key, long expire, Args&&... args)
+      -> node_iterator {
+      auto res = internal_map_.emplace_hint(hint, std::piecewise_construct,
+          std::forward_as_tuple(std::forward<KK>(key)),
+          std::forward_as_tuple(expire, std::forward<Args>(args)...));
+      res->second.bind(res);
+      weighed(res->second);
+      expired_queue_.insert(&res->second);
+      eviction_queue_.insert(&res->second);
+      return res;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline V ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::get(const K& key) const {
+      auto started = recorder().start();
+      auto value = V{};
+      if (auto res = lookup_live(key)) value = res->second.getValue();
+      recorder().get_latency(started);
+      return value;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline V ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::get(const K& key) {
+      // with a bounded budget, reads help drain the backlog as well
+      auto started = recorder().start();
+      auto curtime = current_time();
+      if (expiry_budget_ != expire_all) clearExpired(curtime, expiry_budget_);
       auto value = V{};
       auto res = internal_map_.find(key);
-      if (res != internal_map_.end()){
-      	if (res->second->getExpire() > current_time())
-  		    value = res->second->getValue();
+      auto found = res != internal_map_.end();
+      auto live = found && res->second.getExpire() > curtime;
+      if (live) {
+          value = res->second.getValue();
+          eviction_queue_.access(&res->second);
       }
-      //clearExpired();
+      count_read(found, live);
+      recorder().get_latency(started);
+      deliver_evictions();
       return value;
   }
 
-  template<typename K, typename V>
-  inline std::vector<K> ExpiringMap<K, V>::keys() const {
-      auto curtime = current_time();
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline const V* ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::lookup(const K& key) const {
+      auto started = recorder().start();
+      auto res = lookup_live(key);
+      recorder().get_latency(started);
+      return res ? &res->second.getValue() : nullptr;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline const V* ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::lookup(const K& key) {
+      auto started = recorder().start();
+      auto res = internal_map_.find(key);
+      auto found = res != internal_map_.end();
+      auto live = found && res->second.getExpire() > current_time();
+      if (live) eviction_queue_.access(&res->second);
+      count_read(found, live);
+      recorder().get_latency(started);
+      return live ? &res->second.getValue() : nullptr;
+  }
+
+  // the node of key if it is live, counting the read; reads only
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline auto ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::lookup_live(const K& key) const -> const node_type* {
+      auto res = internal_map_.find(key);
+      auto found = res != internal_map_.end();
+      auto live = found && res->second.getExpire() > current_time();
+      count_read(found, live);
+      return live ? &*res : nullptr;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline std::vector<K> ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::keys() const {
+      // each deadline is read once, next to its key, instead of on every
+      // comparison of the sort
+      auto live = live_entries();
+      std::sort(live.begin(), live.end(), [](const auto& a, const auto& b) {
+          return (a.first != b.first)? a.first < b.first : *a.second < *b.second;
+      });
       auto keys = std::vector<K>{};
-      std::for_each(internal_map_.cbegin(), internal_map_.cend(), [&keys, &curtime](const auto& a) {
-        if (a.second->getExpire() > curtime) keys.push_back(a.first);
+      keys.reserve(live.size());
+      for (const auto& entry : live) keys.push_back(*entry.second);
+      return keys;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline auto ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::begin() const -> const_iterator {
+      return const_iterator(internal_map_.cbegin(), internal_map_.cend(), current_time());
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline auto ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::end() const -> const_iterator {
+      return const_iterator(internal_map_.cend(), internal_map_.cend(), 0);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename F>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::for_each_live(F&& fn) const {
+      auto curtime = current_time();
+      for (const auto& node : internal_map_) {
+          if (node.second.getExpire() > curtime) fn(node.first, node.second.getValue());
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline KeyStream<K> ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::key_stream() const {
+      return KeyStream<K>(live_entries());
+  }
+
+  // the (deadline, key) pairs of the live keys, in key order
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline std::vector<std::pair<long, const K*>> ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::live_entries() const {
+      auto curtime = current_time();
+      auto live = std::vector<std::pair<long, const K*>>{};
+      live.reserve(internal_map_.size());
+      for (const auto& node : internal_map_) {
+          if (node.second.getExpire() > curtime) live.emplace_back(node.second.getExpire(), &node.first);
+      }
+      return live;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline long ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::left(const K& key) const {
+      auto res = internal_map_.find(key);
+      if (res == internal_map_.end()) return 0;
+      return std::max(res->second.getExpire() - current_time(), 0L);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline long ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::next_expiry() const {
+      auto curtime = current_time();
+      auto next = -1L;
+      expired_queue_.visit([curtime, &next](const Item* item) {
+          if (item->getExpire() <= curtime) return true; // expired, not purged yet
+          next = item->getExpire() - curtime;
+          return false;
       });
-      std::sort(keys.begin(), keys.end(), [this](const auto& a, const auto& b) {
-        return (internal_map_[a]->getExpire() != internal_map_[b]->getExpire())?
-          internal_map_[a]->getExpire() < internal_map_[b]->getExpire() : a < b;
+      return next;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  template<typename F>
+  inline size_t ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::expiring_within(long ms, F&& fn, size_t limit) const {
+      auto curtime = current_time();
+      auto visited = size_t{0};
+      if (!limit) return 0;
+      expired_queue_.visit([&](const Item* item) {
+          if (item->getExpire() <= curtime) return true;
+          if (item->getExpire() - curtime > ms) return false;
+          fn(item->getKey(), item->getValue());
+          return ++visited < limit;
       });
-      return keys;
+      return visited;
   }
 
-  template<typename K, typename V>
-  inline long ExpiringMap<K, V>::left(const K& key) const {
-      auto expired_time = 0U;
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline bool ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::touch(const K& key, long ms) {
+      auto curtime = current_time();
       auto res = internal_map_.find(key);
-      if (res != internal_map_.end()){
-      	expired_time = res->second->getExpire() - current_time();
+      auto live = res != internal_map_.end() && res->second.getExpire() > curtime;
+      if (live) {
+          res->second.setExpire(curtime + ms);
+          expired_queue_.update(&res->second);
+          eviction_queue_.access(&res->second);
+          recorder().count(StatsCounter::touches);
       }
-      //clearExpired();
-      return expired_time;
+      clearExpired(curtime, expiry_budget_);
+      deliver_evictions();
+      return live;
   }
 
-  template<typename K, typename V>
-  inline void ExpiringMap<K, V>::erase(const K& key) noexcept {
-      internal_map_.erase(key);
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline V ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::get_and_touch(const K& key, long ms) {
+      auto started = recorder().start();
+      auto curtime = current_time();
+      auto value = V{};
+      auto res = internal_map_.find(key);
+      auto found = res != internal_map_.end();
+      auto live = found && res->second.getExpire() > curtime;
+      if (live) {
+          value = res->second.getValue();
+          res->second.setExpire(curtime + ms);
+          expired_queue_.update(&res->second);
+          eviction_queue_.access(&res->second);
+          recorder().count(StatsCounter::touches);
+      }
+      count_read(found, live);
+      clearExpired(curtime, expiry_budget_);
+      recorder().get_latency(started);
+      deliver_evictions();
+      return value;
   }
 
-  template<typename K, typename V>
-  inline void ExpiringMap<K, V>::clear() noexcept {
-      while(!expired_queue_.empty()) {
-  	    expired_queue_.pop();
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::erase(const K& key) {
+      remove_key(key);
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline bool ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::remove_key(const K& key) {
+      auto res = internal_map_.find(key);
+      if (res == internal_map_.end()) return false;
+      evicted(res->second, EvictionReason::erased);
+      unlink(res->second);
+      internal_map_.erase(res);
+      recorder().count(StatsCounter::erases);
+      return true;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::clear() {
+      if (track_evictions_) {
+          for (auto& node : internal_map_) evicted(node.second, EvictionReason::erased);
       }
+      reset();
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::reset() noexcept {
+      expired_queue_.clear();
+      eviction_queue_.clear();
+      payload_ = 0;
       internal_map_.clear();
   }
 
-  template<typename K, typename V>
-  inline size_t ExpiringMap<K, V>::size() const noexcept {
-      clearExpired();
-      return internal_map_.size();
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline size_t ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::size() const {
+      return internal_map_.size() - count_expired(current_time());
   }
 
-  template<typename K, typename V>
-  inline void ExpiringMap<K, V>::clearExpired() const {
-      while(!expired_queue_.empty()) {
-  	     if (auto top = expired_queue_.top().lock()) {
-  		       if (top->getExpire() > current_time()) break;
-  	 	       internal_map_.erase(top->getKey());
-  	     }
-  	     expired_queue_.pop();
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline size_t ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::expire(size_t budget) {
+      auto expired = clearExpired(current_time(), budget);
+      deliver_evictions();
+      return expired;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline size_t ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::clearExpired(long now, size_t budget) {
+      if (budget == 0) return 0;
+      auto purged = expired_queue_.expire(now, budget, [this](Item* item) {
+          evicted(*item, EvictionReason::expired);
+          eviction_queue_.remove(item);
+          internal_map_.erase(item->node());
+      });
+      recorder().purged(purged);
+      return purged;
+  }
+
+  // the elements that expired by now but were not purged yet
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline size_t ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::count_expired(long now) const {
+      return expired_queue_.count_due(now);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::set_capacity(size_t capacity) {
+      static_assert(!std::is_same<Evict, NoEviction>::value, "set_capacity() needs an eviction policy, e.g. LruEviction");
+      capacity_ = capacity;
+      bound_eviction_queue();
+      trim(current_time());
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::set_weigher(Weigher<K, V> weigher) {
+      weigher_ = std::move(weigher);
+      payload_ = 0;
+      for (const auto& node : internal_map_) weighed(node.second);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::set_max_bytes(size_t bytes) {
+      static_assert(!std::is_same<Evict, NoEviction>::value, "set_max_bytes() needs an eviction policy, e.g. LruEviction");
+      max_bytes_ = bytes;
+      bound_eviction_queue();
+      trim(current_time());
+      deliver_evictions();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline MemoryUsage ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::memory_usage() const noexcept {
+      auto usage = MemoryUsage{};
+      usage.entries = internal_map_.size();
+      usage.nodes = internal_map_.size() * node_bytes;
+      usage.expiry_index = expired_queue_.footprint().bytes;
+      usage.eviction_index = eviction_queue_.bytes();
+      usage.payload = payload_;
+      return usage;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline MapStats ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::stats() const {
+      static_assert(Stats::recorder::enabled, "stats() needs a stats policy, e.g. CountingStats");
+      auto st = recorder().snapshot();
+      st.index_entries = expired_queue_.footprint().entries;
+      return st;
+  }
+
+  // tells the eviction policy how many elements the bounds admit at most
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::bound_eviction_queue() {
+      if (capacity_ == SIZE_MAX && max_bytes_ == SIZE_MAX) return;
+      eviction_queue_.set_capacity(std::min(capacity_, max_bytes_ / node_bytes));
+  }
+
+  // Evicts down to the bounds: expired elements first, as they are free to
+  // drop, in one purge of as many as the map is over, within the expiry
+  // budget, then the eviction policy's victims.
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::trim(long now) {
+      if (!over_bounds()) return;
+      clearExpired(now, std::min(overflow(), expiry_budget_));
+      while (over_bounds()) {
+          auto item = eviction_queue_.victim();
+          if (!item) return; // NoEviction
+          auto expired = item->getExpire() <= now;
+          evicted(*item, expired ? EvictionReason::expired : EvictionReason::capacity);
+          if (!expired) recorder().count(StatsCounter::evictions);
+          unlink(*item);
+          internal_map_.erase(item->node());
       }
   }
 
+  // Hands the elements that left the map during the call that is finishing
+  // to the listener. The vector is swapped out first, so the listener may
+  // use the map, and evictions it causes form a batch of their own. A map
+  // owned by ConcurrentExpiringMap has no listener; its owner drains
+  // evictions_ instead, once the shard is unlocked.
+  template<typename K, typename V, typename Expiry, typename Clock, typename Evict, typename Stats>
+  inline void ExpiringMap<K, V, Expiry, Clock, Evict, Stats>::deliver_evictions() {
+      if (evictions_.empty() || !eviction_listener_) return;
+      auto batch = std::vector<Eviction<K, V>>{};
+      batch.swap(evictions_);
+      eviction_listener_(batch);
+  }
+
 }
+
+#endif // PJ4DEV_EXPIRINGMAP_H
@@ -0,0 +1,161 @@
+//
+// @file: ExpiryClock.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_EXPIRYCLOCK_H
+#define PJ4DEV_EXPIRYCLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace pj4dev {
+
+  //
+  // Clock policies
+  // ----------------------------------------------------------------
+  // The expiring maps read the time through a Clock policy: a type with a
+  // static now() returning milliseconds. Deadlines are only ever compared
+  // with readings of the same clock, so the epoch does not matter, only that
+  // the clock does not run backwards. SteadyClock is the default.
+
+  //
+  // Struct: SystemClock
+  // Usage: ExpiringMap<K, V, HeapExpiry, SystemClock> emap;
+  // ----------------------------------------------------------------
+  // Wall-clock time. Adjusting the system time moves every deadline with it.
+  struct SystemClock {
+      static long now() noexcept {
+          return std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::system_clock::now().time_since_epoch()
+          ).count();
+      }
+  };
+
+  //
+  // Struct: SteadyClock
+  // Usage: ExpiringMap<K, V, HeapExpiry, SteadyClock> emap;
+  // ----------------------------------------------------------------
+  // Monotonic time, unaffected by changes to the system time.
+  struct SteadyClock {
+      static long now() noexcept {
+          return std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now().time_since_epoch()
+          ).count();
+      }
+  };
+
+  //
+  // Struct: TscClock
+  // Usage: ExpiringMap<K, V, HeapExpiry, TscClock> emap;
+  // ----------------------------------------------------------------
+  // Monotonic time read from the CPU's time-stamp counter, which costs a few
+  // nanoseconds instead of a call into the vDSO. The counter is calibrated
+  // against SteadyClock once, on first use (a few milliseconds), and is
+  // assumed to be invariant, i.e. to tick at a constant rate on every core,
+  // as it does on any x86 CPU of the last decade. Elsewhere it falls back to
+  // SteadyClock.
+  struct TscClock {
+      static long now() noexcept {
+  #if defined(__x86_64__) || defined(__i386__)
+          const auto& c = calibration();
+          return c.base_ms + static_cast<long>(static_cast<double>(__rdtsc() - c.base_tsc) * c.ms_per_tick);
+  #else
+          return SteadyClock::now();
+  #endif
+      }
+
+  private:
+  #if defined(__x86_64__) || defined(__i386__)
+      struct Calibration {
+          Calibration() noexcept {
+              using namespace std::chrono;
+              auto start = steady_clock::now();
+              auto start_tsc = __rdtsc();
+              auto end = start;
+              while (end - start < milliseconds(5)) end = steady_clock::now();
+              auto end_tsc = __rdtsc();
+              ms_per_tick = duration<double, std::milli>(end - start).count() / static_cast<double>(end_tsc - start_tsc);
+              base_ms = duration_cast<milliseconds>(end.time_since_epoch()).count();
+              base_tsc = end_tsc;
+          }
+          long base_ms;
+          unsigned long long base_tsc;
+          double ms_per_tick;
+      };
+
+      static const Calibration& calibration() noexcept {
+          static const Calibration c;
+          return c;
+      }
+  #endif
+  };
+
+  //
+  // Struct: CoarseClock
+  // Usage: ExpiringMap<K, V, HeapExpiry, CoarseClock> emap;
+  // ----------------------------------------------------------------
+  // Monotonic time cached in an atomic that a background thread refreshes
+  // from SteadyClock every millisecond, so reading it is a plain load. The
+  // thread starts on first use and is shared by every map using this clock.
+  // Readings may lag by about a millisecond, which only makes entries live
+  // that much longer.
+  struct CoarseClock {
+      static long now() noexcept {
+          return ticker().now.load(std::memory_order_relaxed);
+      }
+
+  private:
+      struct Ticker {
+          Ticker() : now{SteadyClock::now()}, thread{[this]() { run(); }} {}
+          ~Ticker() {
+              stop.store(true, std::memory_order_relaxed);
+              thread.join();
+          }
+          void run() {
+              while (!stop.load(std::memory_order_relaxed)) {
+                  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                  now.store(SteadyClock::now(), std::memory_order_relaxed);
+              }
+          }
+          std::atomic<long> now;
+          std::atomic<bool> stop{false};
+          std::thread thread;  // last, so it starts after everything above
+      };
+
+      static Ticker& ticker() noexcept {
+          static Ticker t;
+          return t;
+      }
+  };
+
+  //
+  // Struct: ManualClock
+  // Usage: ExpiringMap<K, V, HeapExpiry, ManualClock> emap;
+  //        ManualClock::advance(1000);
+  // ----------------------------------------------------------------
+  // Time that only moves when told to, for tests and simulations: expiry
+  // becomes deterministic and hours of TTL churn can be replayed without
+  // waiting. The time is global, shared by every map using this clock, and
+  // starts at zero.
+  struct ManualClock {
+      static long now() noexcept { return time().load(std::memory_order_relaxed); }
+      static void set(long ms) noexcept { time().store(ms, std::memory_order_relaxed); }
+      static void advance(long ms) noexcept { time().fetch_add(ms, std::memory_order_relaxed); }
+
+  private:
+      static std::atomic<long>& time() noexcept {
+          static std::atomic<long> t{0};
+          return t;
+      }
+  };
+
+}
+
+#endif // PJ4DEV_EXPIRYCLOCK_H
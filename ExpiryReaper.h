@@ -0,0 +1,150 @@
+//
+// @file: ExpiryReaper.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_EXPIRYREAPER_H
+#define PJ4DEV_EXPIRYREAPER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace pj4dev {
+
+  //
+  // Class: ExpiryReaper
+  // Usage: ExpiryReaper reaper(std::chrono::milliseconds(10), 1000);
+  // ----------------------------------------------------------------
+  // This class runs a background thread that expires entries of one or more
+  // maps incrementally. Every tick it calls each registered task with the
+  // per-tick budget; a task expires at most that many entries and returns how
+  // many it expired, so one tick's work is bounded no matter how many entries
+  // fell due at once and the remaining backlog is drained by later ticks.
+  // The thread-safe maps register themselves through attach(); any other map
+  // can be registered with add() and a task that takes the map's own lock:
+  //
+  //     reaper.add([&](size_t budget) {
+  //         std::lock_guard<std::mutex> guard(lock);
+  //         return emap.expire(budget);
+  //     });
+  //
+  // Tasks run without the reaper's lock, so a task, or an eviction listener
+  // it calls, may use the reaper, e.g. detach its map. An exception thrown
+  // by a task is caught and dropped; the task counts as having expired
+  // nothing and runs again on the next tick.
+  class ExpiryReaper {
+  public:
+      using task = std::function<size_t(size_t)>;
+
+      explicit ExpiryReaper(std::chrono::milliseconds interval = std::chrono::milliseconds(10),
+                            size_t budget = 1000)
+        : interval_{interval}, budget_{budget}, thread_{[this]() { run(); }} {}
+
+      ExpiryReaper(const ExpiryReaper&) = delete;
+      ExpiryReaper& operator=(const ExpiryReaper&) = delete;
+
+      ~ExpiryReaper() {
+          {
+              std::lock_guard<std::mutex> guard(lock_);
+              stop_ = true;
+          }
+          wakeup_.notify_all();
+          thread_.join();
+      }
+
+      //
+      // Member function: add
+      // Usage: auto id = reaper.add(task);
+      // ----------------------------------------------------------------
+      // This function registers a task and returns an id for remove().
+      size_t add(task fn) {
+          std::lock_guard<std::mutex> guard(lock_);
+          tasks_.emplace_back(++last_id_, std::make_shared<task>(std::move(fn)));
+          return last_id_;
+      }
+
+      //
+      // Member function: remove
+      // Usage: reaper.remove(id);
+      // ----------------------------------------------------------------
+      // This function unregisters a task. Once it returns the task is not
+      // running and will not run again, so its map can be destroyed; if the
+      // task is running, it waits for the task to finish, unless it is called
+      // from the task itself.
+      void remove(size_t id) {
+          std::unique_lock<std::mutex> guard(lock_);
+          for (auto it = tasks_.begin(); it != tasks_.end(); ++it) {
+              if (it->first == id) {
+                  tasks_.erase(it);
+                  break;
+              }
+          }
+          if (std::this_thread::get_id() == thread_.get_id()) return;
+          finished_.wait(guard, [this, id]() { return running_ != id; });
+      }
+
+      // the most entries each task may expire per tick
+      size_t budget() const noexcept { return budget_; }
+
+      // the number of entries expired since the reaper started
+      size_t reaped() const {
+          std::lock_guard<std::mutex> guard(lock_);
+          return reaped_;
+      }
+
+  private:
+      // Each task runs unlocked, marked as running so that remove() can wait
+      // for it. The ids grow with each add(), so after a task the tick goes on
+      // with the next id, however the list changed meanwhile.
+      void run() {
+          std::unique_lock<std::mutex> guard(lock_);
+          while (!stop_) {
+              for (auto it = tasks_.begin(); it != tasks_.end() && !stop_;) {
+                  auto id = it->first;
+                  auto fn = it->second;
+                  running_ = id;
+                  guard.unlock();
+                  auto reaped = size_t{0};
+                  try {
+                      reaped = (*fn)(budget_);
+                  } catch (...) {
+                      // dropped, as the class comment says
+                  }
+                  guard.lock();
+                  running_ = 0;
+                  reaped_ += reaped;
+                  finished_.notify_all();
+                  it = std::upper_bound(tasks_.begin(), tasks_.end(), id,
+                                        [](size_t id, const entry& e) { return id < e.first; });
+              }
+              wakeup_.wait_for(guard, interval_, [this]() { return stop_; });
+          }
+      }
+
+      // tasks are shared so that one keeps running after its own remove()
+      using entry = std::pair<size_t, std::shared_ptr<task>>;
+
+      const std::chrono::milliseconds interval_;
+      const size_t budget_;
+      mutable std::mutex lock_;
+      std::condition_variable wakeup_;
+      std::condition_variable finished_;
+      std::vector<entry> tasks_;
+      size_t last_id_ = 0;
+      size_t running_ = 0;  // the id of the task running, or 0
+      size_t reaped_ = 0;
+      bool stop_ = false;
+      std::thread thread_;  // last, so it starts after everything above
+  };
+
+}
+
+#endif // PJ4DEV_EXPIRYREAPER_H
@@ -0,0 +1,265 @@
+//
+// @file: ExpiryStats.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_EXPIRYSTATS_H
+#define PJ4DEV_EXPIRYSTATS_H
+
+#include "BitOps.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+namespace pj4dev {
+
+  //
+  // Stats policies
+  // ----------------------------------------------------------------
+  // An ExpiringMap reports what its operations do to a Stats policy: a
+  // recorder the map embeds, which counts reads by outcome, writes, purges
+  // and evictions, and times single-key puts and gets. NoStats is the
+  // default; it records nothing and reads no clock, so it compiles away and
+  // takes no room. CountingStats keeps the counts, which ExpiringMap::stats()
+  // returns as a MapStats.
+
+  //
+  // Class: LatencyHistogram
+  // ----------------------------------------------------------------
+  // Latencies in nanoseconds, in log-linear buckets as HdrHistogram keeps
+  // them: eight buckets per power of two, so a percentile is reported
+  // within 12.5% of the true value. Latencies of 2^36 ns (about 69 s) and
+  // more share the last bucket.
+  class LatencyHistogram {
+  public:
+      static constexpr size_t buckets = 34 * 8;
+
+      static size_t bucket(std::uint64_t ns) noexcept {
+          if (ns < 8) return static_cast<size_t>(ns);
+          auto e = highest_bit(ns);
+          if (e >= 36) return buckets - 1;
+          return static_cast<size_t>((e - 2) * 8) + static_cast<size_t>((ns >> (e - 3)) & 7);
+      }
+
+      // the largest latency that falls in bucket i
+      static std::uint64_t highest(size_t i) noexcept {
+          if (i + 1 < 8) return i;
+          if (i + 1 == buckets) return UINT64_MAX;
+          return ((8 + (i + 1) % 8) << ((i + 1) / 8 - 1)) - 1;
+      }
+
+      void add(size_t bucket, std::uint64_t n) noexcept {
+          counts_[bucket] += n;
+          count_ += n;
+      }
+
+      std::uint64_t count() const noexcept { return count_; }
+      std::uint64_t count(size_t bucket) const noexcept { return counts_[bucket]; }
+
+      // the upper bound of the bucket holding the q-th percentile, 0 <= q <= 100
+      std::uint64_t percentile(double q) const noexcept {
+          auto rank = static_cast<std::uint64_t>(q / 100.0 * static_cast<double>(count_) + 0.5);
+          if (rank == 0) rank = 1;
+          auto seen = std::uint64_t{0};
+          for (size_t i = 0; i < buckets; ++i) {
+              seen += counts_[i];
+              if (seen >= rank) return highest(i);
+          }
+          return 0;
+      }
+
+      LatencyHistogram& operator+=(const LatencyHistogram& other) noexcept {
+          for (size_t i = 0; i < buckets; ++i) counts_[i] += other.counts_[i];
+          count_ += other.count_;
+          return *this;
+      }
+
+  private:
+      std::array<std::uint64_t, buckets> counts_{};
+      std::uint64_t count_ = 0;
+  };
+
+  //
+  // Struct: MapStats
+  // Usage: auto st = emap.stats();
+  // ----------------------------------------------------------------
+  // What a map's operations did since it was constructed. Reads are get(),
+  // lookup(), get_batch() and get_and_touch(), one per key; writes are
+  // put(), try_emplace(), insert_or_assign() and put_batch(). A purge is
+  // one pass over the expiry index, by a write, a read on a non-const map,
+  // expire() or a bound; purge_batches[i] counts the passes that removed
+  // 2^i to 2^(i+1)-1 elements.
+  struct MapStats {
+      std::uint64_t hits = 0;           // reads of live keys
+      std::uint64_t misses = 0;         // reads of absent keys
+      std::uint64_t expired_reads = 0;  // reads of keys that had expired but were not purged yet
+      std::uint64_t inserts = 0;        // writes of absent or expired keys
+      std::uint64_t overwrites = 0;     // writes of live keys
+      std::uint64_t erases = 0;         // keys erased by erase() or erase_batch()
+      std::uint64_t touches = 0;        // live keys whose deadline touch() or get_and_touch() moved
+      std::uint64_t evictions = 0;      // live keys evicted to keep within the bounds
+      std::uint64_t purges = 0;         // purges that removed at least one element
+      std::uint64_t purged = 0;         // expired elements those purges removed
+      std::array<std::uint64_t, 64> purge_batches{};
+      LatencyHistogram put_latency;     // put(), try_emplace() and insert_or_assign()
+      LatencyHistogram get_latency;     // get(), lookup() and get_and_touch()
+      size_t index_entries = 0;         // entries in the expiry index
+  };
+
+  // the counters of a Stats policy's recorder
+  enum class StatsCounter : std::uint8_t {
+      hits, misses, expired_reads, inserts, overwrites, erases, touches, evictions
+  };
+
+  //
+  // Struct: NoStats
+  // Usage: ExpiringMap<K, V, HeapExpiry, SteadyClock, NoEviction, NoStats> emap;
+  // ----------------------------------------------------------------
+  // Records nothing, at no cost.
+  struct NoStats {
+      class recorder {
+      public:
+          using timestamp = int;
+          static constexpr bool enabled = false;
+
+          timestamp start() const noexcept { return 0; }
+          void count(StatsCounter, std::uint64_t = 1) const noexcept {}
+          void purged(size_t) const noexcept {}
+          void put_latency(timestamp) const noexcept {}
+          void get_latency(timestamp) const noexcept {}
+          MapStats snapshot() const noexcept { return MapStats{}; }
+      };
+  };
+
+  //
+  // Struct: CountingStats
+  // Usage: ExpiringMap<K, V, HeapExpiry, SteadyClock, NoEviction, CountingStats> emap;
+  // ----------------------------------------------------------------
+  // Counts into eight stripes of relaxed atomic counters, each thread into
+  // the stripe its index picks, so threads that read a map under a shared
+  // lock do not contend on one counter; a snapshot adds the stripes up.
+  // The counters are striped rather than per thread: a map cannot free or
+  // add up counters that live in other threads' thread_local storage
+  // without a registry of every thread that touched it, so threads whose
+  // indices fall in the same stripe share its counters. A timed operation
+  // reads std::chrono::steady_clock twice. The stripes take about 40 kB per
+  // map, allocated with the map. A copy starts counting from zero, a move
+  // takes the stripes along and leaves a recorder that counts nothing, and
+  // assigning to a map keeps its counts.
+  struct CountingStats {
+      class recorder {
+      public:
+          using timestamp = std::chrono::steady_clock::time_point;
+          static constexpr bool enabled = true;
+
+          recorder() : storage_(new char[storage_bytes]) {
+              void* p = storage_.get();
+              auto space = storage_bytes;
+              stripes_ = static_cast<stripe*>(std::align(alignof(stripe), sizeof(stripe) * stripe_count, p, space));
+              for (size_t i = 0; i < stripe_count; ++i) new (&stripes_[i]) stripe();
+          }
+          recorder(const recorder&) : recorder() {}
+          recorder(recorder&& other) noexcept : storage_(std::move(other.storage_)), stripes_(other.stripes_) {
+              other.stripes_ = nullptr;
+          }
+          recorder& operator=(const recorder&) noexcept { return *this; }
+
+          timestamp start() const noexcept { return std::chrono::steady_clock::now(); }
+
+          void count(StatsCounter counter, std::uint64_t n = 1) const noexcept {
+              if (!stripes_) return;
+              add(mine().counters[static_cast<size_t>(counter)], n);
+          }
+
+          void purged(size_t n) const noexcept {
+              if (!n || !stripes_) return;
+              auto& s = mine();
+              add(s.purges, 1);
+              add(s.purged, n);
+              add(s.purge_batches[static_cast<size_t>(highest_bit(n))], 1);
+          }
+
+          void put_latency(timestamp started) const noexcept {
+              if (stripes_) add(mine().put_latency[bucket(started)], 1);
+          }
+          void get_latency(timestamp started) const noexcept {
+              if (stripes_) add(mine().get_latency[bucket(started)], 1);
+          }
+
+          MapStats snapshot() const noexcept {
+              auto st = MapStats{};
+              std::uint64_t counters[counter_count] = {};
+              for (size_t i = 0; stripes_ && i < stripe_count; ++i) {
+                  const auto& s = stripes_[i];
+                  for (size_t c = 0; c < counter_count; ++c) counters[c] += load(s.counters[c]);
+                  st.purges += load(s.purges);
+                  st.purged += load(s.purged);
+                  for (size_t b = 0; b < st.purge_batches.size(); ++b) st.purge_batches[b] += load(s.purge_batches[b]);
+                  for (size_t b = 0; b < LatencyHistogram::buckets; ++b) {
+                      st.put_latency.add(b, load(s.put_latency[b]));
+                      st.get_latency.add(b, load(s.get_latency[b]));
+                  }
+              }
+              st.hits = counters[static_cast<size_t>(StatsCounter::hits)];
+              st.misses = counters[static_cast<size_t>(StatsCounter::misses)];
+              st.expired_reads = counters[static_cast<size_t>(StatsCounter::expired_reads)];
+              st.inserts = counters[static_cast<size_t>(StatsCounter::inserts)];
+              st.overwrites = counters[static_cast<size_t>(StatsCounter::overwrites)];
+              st.erases = counters[static_cast<size_t>(StatsCounter::erases)];
+              st.touches = counters[static_cast<size_t>(StatsCounter::touches)];
+              st.evictions = counters[static_cast<size_t>(StatsCounter::evictions)];
+              return st;
+          }
+
+      private:
+          static constexpr size_t stripe_count = 8;
+          static constexpr size_t counter_count = static_cast<size_t>(StatsCounter::evictions) + 1;
+          using counter = std::atomic<std::uint64_t>;
+
+          // aligned so that no two stripes share a cache line
+          struct alignas(64) stripe {
+              counter counters[counter_count];
+              counter purges;
+              counter purged;
+              counter purge_batches[64];
+              counter put_latency[LatencyHistogram::buckets];
+              counter get_latency[LatencyHistogram::buckets];
+          };
+
+          // C++14's operator new does not honour alignas(64), so the stripes are
+          // placed in a buffer with room to align them; they need no destructor
+          static_assert(std::is_trivially_destructible<stripe>::value, "stripes are never destroyed");
+          static constexpr size_t storage_bytes = sizeof(stripe) * stripe_count + alignof(stripe) - 1;
+
+          static void add(counter& c, std::uint64_t n) noexcept { c.fetch_add(n, std::memory_order_relaxed); }
+          static std::uint64_t load(const counter& c) noexcept { return c.load(std::memory_order_relaxed); }
+
+          static size_t bucket(timestamp started) noexcept {
+              auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+              return LatencyHistogram::bucket(static_cast<std::uint64_t>(ns > 0 ? ns : 0));
+          }
+
+          // each thread is numbered once, on its first count into any map
+          static size_t thread_index() noexcept {
+              static std::atomic<size_t> next{0};
+              static thread_local const size_t index = next.fetch_add(1, std::memory_order_relaxed);
+              return index;
+          }
+
+          stripe& mine() const noexcept { return stripes_[thread_index() % stripe_count]; }
+
+          std::unique_ptr<char[]> storage_;
+          stripe* stripes_ = nullptr;
+      };
+  };
+
+}
+
+#endif // PJ4DEV_EXPIRYSTATS_H
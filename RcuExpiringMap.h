@@ -0,0 +1,791 @@
+//
+// @file: RcuExpiringMap.h
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+
+#ifndef PJ4DEV_RCUEXPIRINGMAP_H
+#define PJ4DEV_RCUEXPIRINGMAP_H
+
+#include "ExpiringMap.h"
+#include "ExpiryReaper.h"
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+
+namespace pj4dev {
+
+  //
+  // Class: EpochDomain
+  // Usage: EpochDomain::guard g(domain);
+  // ----------------------------------------------------------------
+  // This class provides epoch-based reclamation for read-mostly structures.
+  // A reader announces the global epoch in its own slot for the duration of a
+  // guard; that is one load and one store, so entering and leaving are
+  // wait-free. Writers stamp every unlinked object with the epoch at which it
+  // was retired and free it once the epoch has advanced twice, which can only
+  // happen after every reader that might still see it has left. Reader slots
+  // are claimed per thread; a thread that finds no free slot counts itself in
+  // one of two shared counters instead, picked by the parity of the epoch it
+  // read, so it never waits for a writer either. Guards nest: an inner guard
+  // on the same thread relies on the outer one's announcement, or adds one
+  // more to the same counter.
+  class EpochDomain {
+  public:
+      static constexpr size_t max_readers = 128;
+
+      class guard {
+      public:
+          explicit guard(const EpochDomain& domain)
+            : domain_{&domain}, reader_{this_reader()} {
+              if (reader_ == max_readers) {
+                  epoch_ = domain_->enter_overflow();
+                  return;
+              }
+              auto& slot = domain_->slots_[reader_].epoch;
+              if (slot.load(std::memory_order_relaxed) != 0) {
+                  reader_ = inactive; // nested in another guard of this thread
+                  return;
+              }
+              slot.store(domain_->epoch_.load(std::memory_order_acquire), std::memory_order_relaxed);
+              std::atomic_thread_fence(std::memory_order_seq_cst);
+          }
+          guard(guard&& other) noexcept
+            : domain_{other.domain_}, reader_{other.reader_}, epoch_{other.epoch_} {
+              other.reader_ = inactive;
+          }
+          ~guard() {
+              if (reader_ < max_readers)
+                  domain_->slots_[reader_].epoch.store(0, std::memory_order_release);
+              else if (reader_ == max_readers)
+                  domain_->overflow_[epoch_ & 1].fetch_sub(1, std::memory_order_release);
+          }
+          guard(const guard&) = delete;
+          guard& operator=(const guard&) = delete;
+      private:
+          static constexpr size_t inactive = max_readers + 1;
+
+          const EpochDomain* domain_;
+          size_t reader_;
+          unsigned long epoch_ = 0;  // the epoch counted in, without a slot
+      };
+
+      // the epoch to stamp objects retired now
+      unsigned long epoch() const noexcept { return epoch_.load(std::memory_order_relaxed); }
+
+      // whether an object stamped with `retired` can no longer be reached
+      bool reclaimable(unsigned long retired) const noexcept { return retired + 2 <= epoch(); }
+
+      // Advances the epoch if every active reader has seen the current one.
+      // Called by writers only, which are serialized by the caller.
+      bool try_advance() noexcept {
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          auto current = epoch_.load(std::memory_order_relaxed);
+          for (const auto& slot : slots_) {
+              auto seen = slot.epoch.load(std::memory_order_acquire);
+              if (seen != 0 && seen != current) return false;
+          }
+          if (overflow_[(current - 1) & 1].load(std::memory_order_acquire) != 0) return false;
+          epoch_.store(current + 1, std::memory_order_release);
+          return true;
+      }
+
+  private:
+      struct slot {
+          std::atomic<unsigned long> epoch{0};  // 0 while the reader is idle
+          char padding[64 - sizeof(std::atomic<unsigned long>)];
+      };
+
+      // A thread claims one reader index for its lifetime, shared by every
+      // domain it reads from.
+      struct reader_id {
+          size_t index = max_readers;
+          reader_id() {
+              for (size_t i = 0; i < max_readers; ++i) {
+                  if (!claimed()[i].exchange(true)) {
+                      index = i;
+                      break;
+                  }
+              }
+          }
+          ~reader_id() {
+              if (index != max_readers) claimed()[index].store(false);
+          }
+          static std::atomic<bool>* claimed() {
+              static std::atomic<bool> flags[max_readers];
+              return flags;
+          }
+      };
+
+      // counts a reader without a slot in the current epoch; if the epoch
+      // moved on meanwhile, the count may have come too late to hold it
+      // back, so it is taken again in the new one
+      unsigned long enter_overflow() const noexcept {
+          for (;;) {
+              auto epoch = epoch_.load(std::memory_order_acquire);
+              overflow_[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+              if (epoch_.load(std::memory_order_seq_cst) == epoch) return epoch;
+              overflow_[epoch & 1].fetch_sub(1, std::memory_order_release);
+          }
+      }
+
+      static size_t this_reader() {
+          thread_local reader_id id;
+          return id.index;
+      }
+
+      std::atomic<unsigned long> epoch_{1};
+      mutable slot slots_[max_readers];
+      mutable std::atomic<size_t> overflow_[2] = {};  // readers without a slot, by epoch parity
+  };
+
+  //
+  // Class: RcuExpiringMap
+  // Usage: RcuExpiringMap<K, V> emap;
+  // ----------------------------------------------------------------
+  // This template provides a thread-safe expiring map for read-mostly loads.
+  // get(), left() and keys() never lock: they walk a chained hash table inside
+  // an EpochDomain guard. put(), erase() and expiry are serialized by one
+  // writer mutex and never modify a node a reader may see, apart from its
+  // atomic deadline; they publish a replacement node instead and retire the
+  // old one, so read latency does not depend on write bursts. Growing the table copies every node into a new
+  // table, so it is best presized for the expected number of keys.
+  template<typename K, typename V, typename Expiry = HeapExpiry,
+           typename Hash = std::hash<K>, typename Eq = std::equal_to<K>,
+           typename Clock = SteadyClock>
+  class RcuExpiringMap {
+  private:
+      class Node; // forward declaration
+
+  public:
+      using handle = PinnedValue<V, EpochDomain::guard>;
+
+      explicit RcuExpiringMap(size_t capacity = 16);
+      RcuExpiringMap(const RcuExpiringMap&) = delete;
+      RcuExpiringMap& operator=(const RcuExpiringMap&) = delete;
+      ~RcuExpiringMap();
+
+      //
+      // Member function: put
+      // Usage: emap.put(key, value, duration);
+      // ----------------------------------------------------------------
+      // This function inserts or overwrites a key with the duration for
+      // expiration (in milliseconds). It takes the writer lock.
+      void put(const K& key, const V& value, long ms);
+
+      //
+      // Member function: get
+      // Usage: emap.get(key);
+      // ----------------------------------------------------------------
+      // This function retrieves a value from the given key, or the default value
+      // if the key does not exist or has already expired. It never locks.
+      V get(const K& key) const;
+
+      //
+      // Member function: lookup
+      // Usage: if (auto value = emap.lookup(key)) use(*value);
+      // ----------------------------------------------------------------
+      // This function returns a handle to the value of the given key that
+      // reads it in place. Nodes are immutable and the handle holds an epoch
+      // guard, so the value stays intact even if the key is overwritten or
+      // expires meanwhile; it only delays reclamation. It never locks, and the
+      // handle is empty if the key does not exist or has expired.
+      handle lookup(const K& key) const;
+
+      //
+      // Member function: keys
+      // Usage: auto keys = emap.keys();
+      // ----------------------------------------------------------------
+      // This function returns the keys which are still valid, ordered by their
+      // expiration time. It never locks.
+      std::vector<K> keys() const;
+
+      //
+      // Member function: for_each_live
+      // Usage: emap.for_each_live([](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with the key and the value of every live
+      // element, reading the time once. It never locks: the walk runs inside
+      // one epoch guard, so writers go on meanwhile and reclaim nothing the
+      // walk can still reach. Keys written during the walk may or may not be
+      // visited.
+      template<typename F>
+      void for_each_live(F&& fn) const;
+
+      //
+      // Member function: left
+      // Usage: auto timeLeft = emap.left(key);
+      // ----------------------------------------------------------------
+      // This function returns the remaining time (in milliseconds) of the key,
+      // or zero if it doesn't exist or has already expired. It never locks.
+      long left(const K& key) const;
+
+      //
+      // Member function: next_expiry
+      // Usage: auto timeLeft = emap.next_expiry();
+      // ----------------------------------------------------------------
+      // This function returns the remaining time (in milliseconds) of the
+      // element that expires first, or -1 if no element is live. The expiry
+      // index belongs to the writers, so it takes the writer lock.
+      long next_expiry() const;
+
+      //
+      // Member function: expiring_within
+      // Usage: emap.expiring_within(duration, [](const K& key, const V& value) { ... });
+      // ----------------------------------------------------------------
+      // This function calls fn with each live element that expires within the
+      // given duration, soonest first, up to limit elements, and returns how
+      // many it visited; see ExpiringMap::expiring_within. The elements are
+      // picked under the writer lock and fn is called on copies once it is
+      // released, so it may use the map.
+      template<typename F>
+      size_t expiring_within(long ms, F&& fn, size_t limit = SIZE_MAX) const;
+
+      //
+      // Member function: touch
+      // Usage: emap.touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function resets the remaining time of a live key under the writer
+      // lock. Only the node's atomic deadline changes, so unlike put() it
+      // neither copies the value nor allocates. Returns false if the key does
+      // not exist or has expired.
+      bool touch(const K& key, long ms);
+
+      //
+      // Member function: get_and_touch
+      // Usage: auto value = emap.get_and_touch(key, duration);
+      // ----------------------------------------------------------------
+      // This function returns the value of a live key and resets its remaining
+      // time like touch(), under the writer lock.
+      V get_and_touch(const K& key, long ms);
+
+      //
+      // Member function: erase
+      // Usage: emap.erase(key);
+      // ----------------------------------------------------------------
+      // This function deletes a key and its associated value.
+      void erase(const K& key);
+
+      //
+      // Member function: clear
+      // Usage: emap.clear();
+      // ----------------------------------------------------------------
+      // This function removes all elements.
+      void clear();
+
+      //
+      // Member function: size
+      // Usage: auto s = emap.size();
+      // ----------------------------------------------------------------
+      // This function returns the number of non-expired elements. It takes the
+      // writer lock to purge expired ones first.
+      size_t size() const;
+
+      //
+      // Member function: expire
+      // Usage: auto n = emap.expire(budget);
+      // ----------------------------------------------------------------
+      // This function removes up to `budget` expired elements under the writer
+      // lock and returns how many were removed.
+      size_t expire(size_t budget = expire_all);
+
+      //
+      // Member function: attach
+      // Usage: emap.attach(reaper);
+      // ----------------------------------------------------------------
+      // This function hands expiry over to a (possibly shared) ExpiryReaper so
+      // that put() stops purging expired elements itself. The reaper must
+      // outlive the attachment.
+      void attach(ExpiryReaper& reaper);
+
+      //
+      // Member function: start_reaper
+      // Usage: emap.start_reaper(std::chrono::milliseconds(10), 1000);
+      // ----------------------------------------------------------------
+      // This function attaches the map to a reaper thread of its own.
+      void start_reaper(std::chrono::milliseconds interval, size_t budget);
+
+      //
+      // Member function: detach
+      // Usage: emap.detach();
+      // ----------------------------------------------------------------
+      // This function stops background expiry and lets put() purge again.
+      void detach();
+
+      //
+      // Member function: set_expiry_budget
+      // Usage: emap.set_expiry_budget(64);
+      // ----------------------------------------------------------------
+      // This function bounds how many expired elements a put() may purge;
+      // see ExpiringMap::set_expiry_budget. Reads never purge, since they do
+      // not take the writer lock. While a reaper is attached put() purges
+      // nothing, and the budget takes effect again on detach().
+      void set_expiry_budget(size_t budget);
+
+      //
+      // Member function: expiry_footprint
+      // Usage: auto fp = emap.expiry_footprint();
+      // ----------------------------------------------------------------
+      // This function reports the memory held by the expiry index under the
+      // writer lock; see ExpiringMap::expiry_footprint.
+      ExpiryFootprint expiry_footprint() const;
+
+      //
+      // Member function: set_eviction_listener
+      // Usage: emap.set_eviction_listener([](std::vector<Eviction<K, V>>& evicted) { ... });
+      // ----------------------------------------------------------------
+      // This function sets the function to which elements are handed as they
+      // leave the map; see ExpiringMap::set_eviction_listener. Readers may
+      // still see a retired node, so the batch holds copies of the keys and
+      // values, made under the writer lock and delivered after it is
+      // released. Set it before the map is shared.
+      void set_eviction_listener(EvictionListener<K, V> listener);
+
+  private:
+      class Node {
+      public:
+          using hook_type = typename Expiry::template hook<Node>;
+          Node(size_t h, const K& k, const V& v, long exp)
+            : hash_{h}, key_{k}, value_{v}, expire_{exp}{}
+          size_t getHash() const noexcept { return hash_; }
+          const K& getKey() const noexcept { return key_; }
+          const V& getValue() const noexcept { return value_; }
+          long getExpire() const noexcept { return expire_.load(std::memory_order_relaxed); }
+          void setExpire(long exp) noexcept { expire_.store(exp, std::memory_order_relaxed); }
+          hook_type& hook() noexcept { return hook_; }
+          std::atomic<Node*> next{nullptr};
+      private:
+          const size_t hash_;
+          const K key_;
+          const V value_;
+          std::atomic<long> expire_; // set by the writer only
+          hook_type hook_; // written by the writer only
+      };
+
+      struct Table {
+          explicit Table(size_t capacity)
+            : mask{capacity - 1}, buckets{new std::atomic<Node*>[capacity]} {
+              for (size_t i = 0; i < capacity; ++i) buckets[i].store(nullptr, std::memory_order_relaxed);
+          }
+          const size_t mask;
+          std::unique_ptr<std::atomic<Node*>[]> buckets;
+      };
+
+      // retired objects are reclaimed in batches of this many
+      static constexpr size_t reclaim_batch = 128;
+
+      mutable std::mutex lock_;
+      mutable EpochDomain domain_;
+      std::atomic<Table*> table_;
+      mutable typename Expiry::template index<Node> expired_queue_;
+      mutable size_t size_ = 0;
+      mutable std::vector<std::pair<unsigned long, Node*>> retired_nodes_;
+      mutable std::vector<std::pair<unsigned long, Table*>> retired_tables_;
+      Hash hash_;
+      Eq eq_;
+      size_t expiry_budget_ = expire_all;
+      size_t inline_budget_ = expire_all; // expiry_budget_, or 0 while attached
+      ExpiryReaper* reaper_ = nullptr;
+      size_t reaper_task_ = 0;
+      std::unique_ptr<ExpiryReaper> owned_reaper_;
+      EvictionListener<K, V> eviction_listener_;
+      mutable std::vector<Eviction<K, V>> evictions_;
+      bool track_evictions_ = false;
+
+      static long current_time() noexcept { return Clock::now(); }
+
+      size_t hash_of(const K& key) const {
+          auto h = static_cast<std::uint64_t>(hash_(key)) * 0x9E3779B97F4A7C15ULL;
+          return static_cast<size_t>(h ^ (h >> 32));
+      }
+
+      const Node* find(const K& key) const;
+      std::atomic<Node*>* link_to(const Node* node) const;
+      void unlink(Node* node) const;
+      void grow();
+      void retire(Node* node) const;
+      void reclaim() const;
+      size_t clearExpired(long now, size_t budget) const;
+      void evicted(const Node* node, EvictionReason reason) const {
+          if (track_evictions_) evictions_.push_back({node->getKey(), node->getValue(), reason});
+      }
+      void deliver_evictions(std::unique_lock<std::mutex>& guard) const;
+  };
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::RcuExpiringMap(size_t capacity) {
+      auto buckets = size_t{16};
+      while (buckets < capacity) buckets *= 2;
+      table_.store(new Table(buckets), std::memory_order_release);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::~RcuExpiringMap() {
+      detach();
+      auto table = table_.load(std::memory_order_relaxed);
+      for (size_t b = 0; b <= table->mask; ++b) {
+          for (auto node = table->buckets[b].load(std::memory_order_relaxed); node; ) {
+              auto next = node->next.load(std::memory_order_relaxed);
+              delete node;
+              node = next;
+          }
+      }
+      delete table;
+      for (auto& retired : retired_nodes_) delete retired.second;
+      for (auto& retired : retired_tables_) delete retired.second;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::put(const K& key, const V& value, long ms) {
+      auto h = hash_of(key);
+      std::unique_lock<std::mutex> guard(lock_);
+      auto curtime = current_time();
+      auto node = new Node(h, key, value, curtime + ms);
+      auto table = table_.load(std::memory_order_relaxed);
+      auto& head = table->buckets[h & table->mask];
+      auto link = &head;
+      auto cur = link->load(std::memory_order_relaxed);
+      while (cur && !(cur->getHash() == h && eq_(cur->getKey(), key))) {
+          link = &cur->next;
+          cur = link->load(std::memory_order_relaxed);
+      }
+      if (cur) {
+          node->next.store(cur->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+          link->store(node, std::memory_order_release);
+          evicted(cur, cur->getExpire() > curtime ? EvictionReason::replaced : EvictionReason::expired);
+          expired_queue_.remove(cur);
+          retire(cur);
+      } else {
+          node->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+          head.store(node, std::memory_order_release);
+          ++size_;
+      }
+      expired_queue_.insert(node);
+      if (size_ > table->mask + 1) grow();
+      clearExpired(curtime, inline_budget_);
+      reclaim();
+      deliver_evictions(guard);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline V RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::get(const K& key) const {
+      EpochDomain::guard guard(domain_);
+      auto node = find(key);
+      if (node && node->getExpire() > current_time())
+          return node->getValue();
+      return V{};
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline auto RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::lookup(const K& key) const -> handle {
+      EpochDomain::guard guard(domain_);
+      auto node = find(key);
+      if (node && node->getExpire() > current_time())
+          return handle(std::move(guard), &node->getValue());
+      return handle(std::move(guard), nullptr);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline std::vector<K> RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::keys() const {
+      auto live = std::vector<std::pair<long, K>>{};
+      {
+          EpochDomain::guard guard(domain_);
+          auto curtime = current_time();
+          auto table = table_.load(std::memory_order_acquire);
+          for (size_t b = 0; b <= table->mask; ++b) {
+              for (auto node = table->buckets[b].load(std::memory_order_acquire); node;
+                   node = node->next.load(std::memory_order_acquire)) {
+                  if (node->getExpire() > curtime)
+                      live.emplace_back(node->getExpire(), node->getKey());
+              }
+          }
+      }
+      std::sort(live.begin(), live.end());
+      auto keys = std::vector<K>{};
+      keys.reserve(live.size());
+      for (auto& entry : live) keys.push_back(std::move(entry.second));
+      return keys;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  template<typename F>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::for_each_live(F&& fn) const {
+      EpochDomain::guard guard(domain_);
+      auto curtime = current_time();
+      auto table = table_.load(std::memory_order_acquire);
+      for (size_t b = 0; b <= table->mask; ++b) {
+          for (auto node = table->buckets[b].load(std::memory_order_acquire); node;
+               node = node->next.load(std::memory_order_acquire)) {
+              if (node->getExpire() > curtime) fn(node->getKey(), node->getValue());
+          }
+      }
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline long RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::left(const K& key) const {
+      EpochDomain::guard guard(domain_);
+      auto node = find(key);
+      if (!node) return 0;
+      return std::max(0L, node->getExpire() - current_time());
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline long RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::next_expiry() const {
+      std::lock_guard<std::mutex> guard(lock_);
+      auto curtime = current_time();
+      auto next = -1L;
+      expired_queue_.visit([curtime, &next](const Node* node) {
+          if (node->getExpire() <= curtime) return true; // expired, not purged yet
+          next = node->getExpire() - curtime;
+          return false;
+      });
+      return next;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  template<typename F>
+  inline size_t RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::expiring_within(long ms, F&& fn, size_t limit) const {
+      auto soonest = std::vector<std::pair<K, V>>{};
+      if (!limit) return 0;
+      {
+          std::lock_guard<std::mutex> guard(lock_);
+          auto curtime = current_time();
+          expired_queue_.visit([&](const Node* node) {
+              if (node->getExpire() <= curtime) return true;
+              if (node->getExpire() - curtime > ms) return false;
+              soonest.emplace_back(node->getKey(), node->getValue());
+              return soonest.size() < limit;
+          });
+      }
+      for (const auto& entry : soonest) fn(entry.first, entry.second);
+      return soonest.size();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline bool RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::touch(const K& key, long ms) {
+      std::unique_lock<std::mutex> guard(lock_);
+      auto curtime = current_time();
+      auto node = const_cast<Node*>(find(key));
+      auto live = node && node->getExpire() > curtime;
+      if (live) {
+          node->setExpire(curtime + ms);
+          expired_queue_.update(node);
+      }
+      clearExpired(curtime, inline_budget_);
+      reclaim();
+      deliver_evictions(guard);
+      return live;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline V RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::get_and_touch(const K& key, long ms) {
+      std::unique_lock<std::mutex> guard(lock_);
+      auto curtime = current_time();
+      auto value = V{};
+      auto node = const_cast<Node*>(find(key));
+      if (node && node->getExpire() > curtime) {
+          value = node->getValue();
+          node->setExpire(curtime + ms);
+          expired_queue_.update(node);
+      }
+      clearExpired(curtime, inline_budget_);
+      reclaim();
+      deliver_evictions(guard);
+      return value;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::erase(const K& key) {
+      std::unique_lock<std::mutex> guard(lock_);
+      auto node = const_cast<Node*>(find(key));
+      if (node) {
+          evicted(node, EvictionReason::erased);
+          expired_queue_.remove(node);
+          unlink(node);
+      }
+      reclaim();
+      deliver_evictions(guard);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::clear() {
+      std::unique_lock<std::mutex> guard(lock_);
+      auto table = table_.load(std::memory_order_relaxed);
+      for (size_t b = 0; b <= table->mask; ++b) {
+          auto node = table->buckets[b].exchange(nullptr, std::memory_order_acq_rel);
+          for (; node; node = node->next.load(std::memory_order_relaxed)) {
+              evicted(node, EvictionReason::erased);
+              retire(node);
+          }
+      }
+      expired_queue_.clear();
+      size_ = 0;
+      reclaim();
+      deliver_evictions(guard);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline size_t RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::size() const {
+      std::unique_lock<std::mutex> guard(lock_);
+      clearExpired(current_time(), expire_all);
+      reclaim();
+      auto size = size_;
+      deliver_evictions(guard);
+      return size;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline size_t RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::expire(size_t budget) {
+      std::unique_lock<std::mutex> guard(lock_);
+      auto expired = clearExpired(current_time(), budget);
+      reclaim();
+      deliver_evictions(guard);
+      return expired;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline ExpiryFootprint RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::expiry_footprint() const {
+      std::lock_guard<std::mutex> guard(lock_);
+      return expired_queue_.footprint();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::attach(ExpiryReaper& reaper) {
+      detach();
+      {
+          std::lock_guard<std::mutex> guard(lock_);
+          inline_budget_ = 0;
+      }
+      reaper_ = &reaper;
+      reaper_task_ = reaper.add([this](size_t budget) { return expire(budget); });
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::start_reaper(std::chrono::milliseconds interval, size_t budget) {
+      detach();
+      owned_reaper_.reset(new ExpiryReaper(interval, budget));
+      attach(*owned_reaper_);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::detach() {
+      if (!reaper_) return;
+      reaper_->remove(reaper_task_);
+      reaper_ = nullptr;
+      std::lock_guard<std::mutex> guard(lock_);
+      inline_budget_ = expiry_budget_;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::set_expiry_budget(size_t budget) {
+      std::lock_guard<std::mutex> guard(lock_);
+      expiry_budget_ = budget;
+      if (!reaper_) inline_budget_ = budget;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::set_eviction_listener(EvictionListener<K, V> listener) {
+      std::lock_guard<std::mutex> guard(lock_);
+      eviction_listener_ = std::move(listener);
+      track_evictions_ = static_cast<bool>(eviction_listener_);
+      evictions_.clear();
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline auto RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::find(const K& key) const -> const Node* {
+      auto h = hash_of(key);
+      auto table = table_.load(std::memory_order_acquire);
+      for (auto node = table->buckets[h & table->mask].load(std::memory_order_acquire); node;
+           node = node->next.load(std::memory_order_acquire)) {
+          if (node->getHash() == h && eq_(node->getKey(), key)) return node;
+      }
+      return nullptr;
+  }
+
+  // Returns the pointer that links `node` into its chain (writer only).
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline auto RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::link_to(const Node* node) const -> std::atomic<Node*>* {
+      auto table = table_.load(std::memory_order_relaxed);
+      auto link = &table->buckets[node->getHash() & table->mask];
+      while (link->load(std::memory_order_relaxed) != node)
+          link = &link->load(std::memory_order_relaxed)->next;
+      return link;
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::unlink(Node* node) const {
+      link_to(node)->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+      --size_;
+      retire(node);
+  }
+
+  // Readers may be walking the old chains, so the nodes are copied into a
+  // table twice the size and the old ones are retired with the old table.
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::grow() {
+      auto old = table_.load(std::memory_order_relaxed);
+      auto table = new Table(2 * (old->mask + 1));
+      expired_queue_.clear();
+      for (size_t b = 0; b <= old->mask; ++b) {
+          for (auto node = old->buckets[b].load(std::memory_order_relaxed); node;
+               node = node->next.load(std::memory_order_relaxed)) {
+              auto copy = new Node(node->getHash(), node->getKey(), node->getValue(), node->getExpire());
+              auto& head = table->buckets[copy->getHash() & table->mask];
+              copy->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+              head.store(copy, std::memory_order_relaxed);
+              expired_queue_.insert(copy);
+              retire(node);
+          }
+      }
+      table_.store(table, std::memory_order_release);
+      retired_tables_.emplace_back(domain_.epoch(), old);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::retire(Node* node) const {
+      retired_nodes_.emplace_back(domain_.epoch(), node);
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::reclaim() const {
+      if (retired_nodes_.size() < reclaim_batch && retired_tables_.empty()) return;
+      domain_.try_advance();
+      auto free_node = [this](const std::pair<unsigned long, Node*>& retired) {
+          if (!domain_.reclaimable(retired.first)) return false;
+          delete retired.second;
+          return true;
+      };
+      retired_nodes_.erase(std::remove_if(retired_nodes_.begin(), retired_nodes_.end(), free_node),
+                           retired_nodes_.end());
+      auto free_table = [this](const std::pair<unsigned long, Table*>& retired) {
+          if (!domain_.reclaimable(retired.first)) return false;
+          delete retired.second;
+          return true;
+      };
+      retired_tables_.erase(std::remove_if(retired_tables_.begin(), retired_tables_.end(), free_table),
+                            retired_tables_.end());
+  }
+
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline size_t RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::clearExpired(long now, size_t budget) const {
+      if (budget == 0) return 0;
+      return expired_queue_.expire(now, budget, [this](Node* node) {
+          evicted(node, EvictionReason::expired);
+          unlink(node);
+      });
+  }
+
+  // Takes the batch under the writer lock and delivers it after releasing it.
+  template<typename K, typename V, typename Expiry, typename Hash, typename Eq, typename Clock>
+  inline void RcuExpiringMap<K, V, Expiry, Hash, Eq, Clock>::deliver_evictions(std::unique_lock<std::mutex>& guard) const {
+      if (evictions_.empty()) return;
+      auto batch = std::vector<Eviction<K, V>>{};
+      batch.swap(evictions_);
+      guard.unlock();
+      eviction_listener_(batch);
+  }
+
+}
+
+#endif // PJ4DEV_RCUEXPIRINGMAP_H
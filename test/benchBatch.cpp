@@ -0,0 +1,103 @@
+//
+// @file: benchBatch.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Compares put/get/erase one key at a time with put_batch, get_batch and
+// erase_batch on the same keys, in batches of 64, for each map: once with
+// random keys and once with batches of neighbouring keys. The batched calls
+// read the clock and purge once per batch; the ordered maps visit each batch
+// in key order and the hash map fetches a batch's slots together.
+
+#include "ConcurrentExpiringMap.h"
+#include "ExpiringHashMap.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+static const size_t n = 1000000;
+static const size_t batch = 64;
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* name, const char* op, double single, double batched) {
+	std::cout << name << ": " << op << " " << n / single / 1e3 << " -> " << n / batched / 1e3
+		<< " Mops/s (x" << single / batched << ")" << std::endl;
+}
+
+template<typename Map>
+void bench_batch(const char* name, const std::vector<std::pair<long, long>>& entries, const std::vector<long>& keys) {
+	auto out = std::vector<long>(batch);
+	auto sum = 0L;
+
+	Map single;
+	auto start = std::chrono::steady_clock::now();
+	for (const auto& entry : entries) single.put(entry.first, entry.second, 600000);
+	auto put = elapsed_ms(start);
+	start = std::chrono::steady_clock::now();
+	for (auto key : keys) sum += single.get(key);
+	auto get = elapsed_ms(start);
+	start = std::chrono::steady_clock::now();
+	for (auto key : keys) single.erase(key);
+	auto erase = elapsed_ms(start);
+
+	Map batched;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i += batch)
+		batched.put_batch(entries.begin() + i, entries.begin() + std::min(n, i + batch), 600000);
+	auto put_batch = elapsed_ms(start);
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i += batch) {
+		batched.get_batch(keys.begin() + i, keys.begin() + std::min(n, i + batch), out.data());
+		sum -= out[0];
+	}
+	auto get_batch = elapsed_ms(start);
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n; i += batch)
+		batched.erase_batch(keys.begin() + i, keys.begin() + std::min(n, i + batch));
+	auto erase_batch = elapsed_ms(start);
+
+	report(name, "put  ", put, put_batch);
+	report(name, "get  ", get, get_batch);
+	report(name, "erase", erase, erase_batch);
+	if (sum == 42) std::cout << std::endl; // keeps the reads alive
+}
+
+int main() {
+	std::mt19937_64 rng(42);
+	auto entries = std::vector<std::pair<long, long>>(n);
+	for (auto& entry : entries) entry = {static_cast<long>(rng() % (4 * n)), static_cast<long>(rng())};
+	// read and erase in an order unrelated to the insertion order
+	auto keys = std::vector<long>{};
+	for (const auto& entry : entries) keys.push_back(entry.first);
+	std::shuffle(keys.begin(), keys.end(), rng);
+
+	std::cout << "<=== " << n << " random keys, single calls -> batches of " << batch << "\n";
+	bench_batch<pj4dev::ExpiringMap<long, long>>("map,  heap ", entries, keys);
+	bench_batch<pj4dev::ExpiringMap<long, long, pj4dev::WheelExpiry>>("map,  wheel", entries, keys);
+	bench_batch<pj4dev::ExpiringHashMap<long, long>>("hash, heap ", entries, keys);
+	bench_batch<pj4dev::ConcurrentExpiringMap<long, long>>("concurrent ", entries, keys);
+
+	// each batch is a run of neighbouring keys, e.g. the sessions of one
+	// tenant, given in random order
+	for (size_t i = 0; i < n; i += batch) {
+		auto base = static_cast<long>(rng() % (64 * n));
+		for (size_t j = i; j < std::min(n, i + batch); ++j) {
+			entries[j] = {base + static_cast<long>(j - i), static_cast<long>(rng())};
+			keys[j] = entries[j].first;
+		}
+		std::shuffle(entries.begin() + i, entries.begin() + std::min(n, i + batch), rng);
+		std::shuffle(keys.begin() + i, keys.begin() + std::min(n, i + batch), rng);
+	}
+
+	std::cout << "<=== " << n << " keys in runs of " << batch << ", single calls -> batches of " << batch << "\n";
+	bench_batch<pj4dev::ExpiringMap<long, long>>("map,  heap ", entries, keys);
+	bench_batch<pj4dev::ExpiringMap<long, long, pj4dev::WheelExpiry>>("map,  wheel", entries, keys);
+	bench_batch<pj4dev::ExpiringHashMap<long, long>>("hash, heap ", entries, keys);
+	bench_batch<pj4dev::ConcurrentExpiringMap<long, long>>("concurrent ", entries, keys);
+}
@@ -0,0 +1,52 @@
+//
+// @file: benchChurn.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Replays hours of TTL churn on a ManualClock in a fraction of that time:
+// every simulated 100 ms a burst of keys is written with TTLs between one
+// second and one hour. The run is deterministic, so the live counts printed
+// are the same on every machine and for both expiry policies. Most puts
+// overwrite a key that is still live, so the hourly expiry index footprint
+// shows whether overwrites leave anything behind.
+
+#include "ExpiringMap.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+
+static const long sim_hours = 6;
+static const long step_ms = 100;
+static const long puts_per_step = 20;
+static const long key_space = 200000;
+
+template<typename Expiry>
+void bench_churn(const char* name) {
+	pj4dev::ManualClock::set(0);
+	pj4dev::ExpiringMap<long, long, Expiry, pj4dev::ManualClock> emap;
+	std::mt19937_64 rng(42);
+	auto start = std::chrono::steady_clock::now();
+	auto puts = 0L;
+	for (long t = 0; t < sim_hours * 3600000; t += step_ms) {
+		for (long i = 0; i < puts_per_step; ++i, ++puts) {
+			auto key = static_cast<long>(rng() % key_space);
+			emap.put(key, key, 1000 + static_cast<long>(rng() % 3600000));
+		}
+		pj4dev::ManualClock::advance(step_ms);
+		if (t % 3600000 == 0 && t) {
+			auto live = emap.size();
+			auto fp = emap.expiry_footprint();
+			std::cout << name << ": hour " << t / 3600000 << ", live " << live << ", index entries "
+				<< fp.entries << ", reserved " << fp.reserved << ", " << fp.bytes << " bytes\n";
+		}
+	}
+	auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << name << ": " << sim_hours << " simulated hours, " << puts << " puts in " << secs
+		<< " s (" << puts / secs / 1e6 << " Mputs/s), live " << emap.size() << std::endl;
+}
+
+int main() {
+	bench_churn<pj4dev::HeapExpiry>("heap ");
+	bench_churn<pj4dev::WheelExpiry>("wheel");
+}
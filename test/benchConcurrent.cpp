@@ -0,0 +1,63 @@
+//
+// @file: benchConcurrent.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Measures multi-threaded throughput of a 90% get / 10% put mix on an
+// ExpiringMap behind one global mutex and on a ConcurrentExpiringMap.
+
+#include "ConcurrentExpiringMap.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+
+static const long key_space = 1000000;
+static const size_t ops_per_thread = 500000;
+
+struct GlobalLockMap {
+	std::mutex lock;
+	pj4dev::ExpiringMap<long, long> map;
+	void put(long key, long value, long ms) {
+		std::lock_guard<std::mutex> guard(lock);
+		map.put(key, value, ms);
+	}
+	long get(long key) {
+		std::lock_guard<std::mutex> guard(lock);
+		return map.get(key);
+	}
+};
+
+template<typename Map>
+void bench_mix(const char* name, Map& emap, unsigned threads) {
+	std::vector<std::thread> workers;
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned t = 0; t < threads; ++t) {
+		workers.emplace_back([&emap, t]() {
+			std::mt19937_64 rng(t);
+			auto sum = 0L;
+			for (size_t i = 0; i < ops_per_thread; ++i) {
+				auto key = static_cast<long>(rng() % key_space);
+				if (i % 10 == 0) emap.put(key, key, 60000);
+				else sum += emap.get(key);
+			}
+			if (sum == -1) std::cout << sum; // keep the reads alive
+		});
+	}
+	for (auto& worker : workers) worker.join();
+	auto secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << name << " x" << threads << ": "
+		<< threads * ops_per_thread / secs / 1e6 << " Mops/s" << std::endl;
+}
+
+int main() {
+	auto max_threads = std::max(4U, 2 * std::thread::hardware_concurrency());
+	for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+		GlobalLockMap global;
+		bench_mix("global mutex", global, threads);
+		pj4dev::ConcurrentExpiringMap<long, long> sharded;
+		bench_mix("sharded     ", sharded, threads);
+	}
+}
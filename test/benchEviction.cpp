@@ -0,0 +1,111 @@
+//
+// @file: benchEviction.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Replays Zipfian key traces against a capacity-bounded ExpiringMap used as
+// a cache: a get() that misses is followed by a put() of the key. Prints the
+// hit ratio and the throughput of each eviction policy, for two skews and
+// for a trace where scans of one-off keys interrupt the Zipfian traffic.
+// The TTL is long enough that only the capacity bound evicts. A last run
+// caches strings of varied length under a bound on bytes, with a weigher,
+// and prints the memory_usage() breakdown.
+
+#include "ExpiringMap.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+static const size_t key_space = 1000000;
+static const size_t requests = 4000000;
+static const size_t capacity = 10000;
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// keys drawn with P(rank r) proportional to 1 / r^skew, ranks scattered over
+// the key space so that popular keys are not neighbours in the map
+static std::vector<long> zipf_trace(double skew, std::mt19937_64& rng) {
+	auto cdf = std::vector<double>(key_space);
+	auto sum = 0.0;
+	for (size_t r = 0; r < key_space; ++r) cdf[r] = sum += 1.0 / std::pow(static_cast<double>(r + 1), skew);
+	std::uniform_real_distribution<double> uniform(0.0, sum);
+	auto trace = std::vector<long>(requests);
+	for (auto& key : trace) {
+		auto rank = static_cast<long>(std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin());
+		key = (rank * 2654435761L) % static_cast<long>(key_space);
+	}
+	return trace;
+}
+
+// every 100000 requests, a scan of 20000 keys that are never seen again
+static std::vector<long> scan_trace(std::vector<long> trace) {
+	auto next = static_cast<long>(key_space);
+	for (size_t i = 0; i + 20000 <= trace.size(); i += 100000) {
+		for (size_t j = i; j < i + 20000; ++j) trace[j] = next++;
+	}
+	return trace;
+}
+
+template<typename Evict>
+void bench_policy(const char* name, const std::vector<long>& trace) {
+	pj4dev::ExpiringMap<long, long, pj4dev::HeapExpiry, pj4dev::SteadyClock, Evict> cache;
+	cache.set_capacity(capacity);
+	auto hits = size_t{0};
+	auto start = std::chrono::steady_clock::now();
+	for (auto key : trace) {
+		if (cache.lookup(key)) ++hits;
+		else cache.put(key, key, 600000);
+	}
+	auto ms = elapsed_ms(start);
+	std::cout << name << ": hit ratio " << 100.0 * static_cast<double>(hits) / static_cast<double>(trace.size())
+		<< "%, " << static_cast<double>(trace.size()) / ms / 1e3 << " Mops/s" << std::endl;
+}
+
+// values of 16 to 4096 bytes, the same length for the same key every time
+template<typename Evict>
+void bench_bytes(const char* name, const std::vector<long>& trace, size_t max_bytes) {
+	pj4dev::ExpiringMap<long, std::string, pj4dev::HeapExpiry, pj4dev::SteadyClock, Evict> cache;
+	cache.set_weigher([](const long&, const std::string& value) { return value.capacity() + 1; });
+	cache.set_max_bytes(max_bytes);
+	auto hits = size_t{0};
+	auto start = std::chrono::steady_clock::now();
+	for (auto key : trace) {
+		if (cache.lookup(key)) ++hits;
+		else cache.put(key, std::string(16 + static_cast<size_t>(key * 40503L) % 4080, 'v'), 600000);
+	}
+	auto ms = elapsed_ms(start);
+	auto mu = cache.memory_usage();
+	std::cout << name << ": hit ratio " << 100.0 * static_cast<double>(hits) / static_cast<double>(trace.size())
+		<< "%, " << static_cast<double>(trace.size()) / ms / 1e3 << " Mops/s; " << mu.entries << " entries, "
+		<< mu.nodes << " B nodes + " << mu.payload << " B payload + " << mu.expiry_index << " B expiry index + "
+		<< mu.eviction_index << " B eviction index = " << mu.total() << " B" << std::endl;
+}
+
+static void bench_trace(const char* title, const std::vector<long>& trace) {
+	std::cout << "<=== " << title << ", " << requests << " requests over " << key_space
+		<< " keys, capacity " << capacity << "\n";
+	bench_policy<pj4dev::LruEviction>("lru    ", trace);
+	bench_policy<pj4dev::ClockEviction>("clock  ", trace);
+	bench_policy<pj4dev::TinyLfuEviction>("tinylfu", trace);
+}
+
+int main() {
+	std::mt19937_64 rng(42);
+	auto trace = zipf_trace(0.8, rng);
+	bench_trace("zipf 0.8", trace);
+	bench_trace("zipf 0.8 with scans", scan_trace(trace));
+	bench_trace("zipf 1.0", zipf_trace(1.0, rng));
+
+	const size_t max_bytes = 16 << 20;
+	std::cout << "<=== zipf 0.8, values of 16 to 4096 bytes, at most " << max_bytes << " bytes\n";
+	bench_bytes<pj4dev::LruEviction>("lru    ", trace, max_bytes);
+	bench_bytes<pj4dev::ClockEviction>("clock  ", trace, max_bytes);
+	bench_bytes<pj4dev::TinyLfuEviction>("tinylfu", trace, max_bytes);
+}
@@ -0,0 +1,98 @@
+//
+// @file: benchExpiry.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Compares the HeapExpiry and WheelExpiry policies: raw scheduling and
+// expiry cost of the index, put() throughput of the whole map, and a
+// refresh-heavy mix where most puts overwrite a live key.
+
+#include "ExpiringMap.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <string>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a bare node carrying only a deadline and the policy's hook
+template<typename Expiry>
+struct Timer {
+	using hook_type = typename Expiry::template hook<Timer>;
+	long expire;
+	hook_type hook_;
+	long getExpire() const noexcept { return expire; }
+	hook_type& hook() noexcept { return hook_; }
+};
+
+template<typename Expiry>
+void bench_index(const char* name, const std::vector<long>& ttls) {
+	typename Expiry::template index<Timer<Expiry>> index;
+	std::vector<Timer<Expiry>> timers(ttls.size());
+	const long base = 1474502400000L; // an epoch time in milliseconds
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ttls.size(); ++i) {
+		timers[i].expire = base + ttls[i];
+		index.insert(&timers[i]);
+	}
+	auto schedule = elapsed_ms(start);
+
+	// advance the clock in 10ms steps through the whole TTL range
+	auto fired = size_t{0};
+	start = std::chrono::steady_clock::now();
+	for (long now = base; now <= base + 3600000L; now += 10)
+		index.expire(now, pj4dev::expire_all, [&fired](Timer<Expiry>*) { ++fired; });
+	auto expire = elapsed_ms(start);
+
+	std::cout << name << ": schedule " << schedule << " ms, expire " << expire
+		<< " ms (" << fired << " fired)" << std::endl;
+}
+
+template<typename Expiry>
+void bench_put(const char* name, const std::vector<long>& ttls) {
+	pj4dev::ExpiringMap<long, long, Expiry> emap;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < ttls.size(); ++i)
+		emap.put(static_cast<long>(i), static_cast<long>(i), ttls[i]);
+	auto put = elapsed_ms(start);
+	std::cout << name << ": put " << put << " ms (" << emap.size() << " keys)" << std::endl;
+}
+
+// 80% of the puts refresh one of the prefilled keys, 20% add a new one
+template<typename Expiry>
+void bench_refresh(const char* name, size_t keys, size_t puts) {
+	pj4dev::ExpiringMap<long, std::string, Expiry> emap;
+	for (size_t i = 0; i < keys; ++i) emap.put(static_cast<long>(i), "session", 600000);
+	std::mt19937_64 rng(7);
+	auto next_key = static_cast<long>(keys);
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < puts; ++i) {
+		auto key = rng() % 5 ? static_cast<long>(rng() % keys) : next_key++;
+		emap.put(key, "session", 600000 + static_cast<long>(rng() % 1000));
+	}
+	auto put = elapsed_ms(start);
+	std::cout << name << ": " << puts / put / 1e3 << " Mputs/s (" << emap.size() << " keys)" << std::endl;
+}
+
+int main() {
+	const size_t n = 1000000;
+	std::mt19937_64 rng(42);
+	std::uniform_int_distribution<long> ttl(50, 3600000);
+	std::vector<long> ttls(n);
+	for (auto& t : ttls) t = ttl(rng);
+
+	std::cout << "<=== index, " << n << " deadlines between 50ms and 1h\n";
+	bench_index<pj4dev::HeapExpiry>("heap ", ttls);
+	bench_index<pj4dev::WheelExpiry>("wheel", ttls);
+
+	std::cout << "<=== ExpiringMap::put, " << n << " keys\n";
+	bench_put<pj4dev::HeapExpiry>("heap ", ttls);
+	bench_put<pj4dev::WheelExpiry>("wheel", ttls);
+
+	std::cout << "<=== ExpiringMap::put, 80% refreshes of " << n / 4 << " keys\n";
+	bench_refresh<pj4dev::HeapExpiry>("heap ", n / 4, 2 * n);
+	bench_refresh<pj4dev::WheelExpiry>("wheel", n / 4, 2 * n);
+}
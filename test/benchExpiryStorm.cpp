@@ -0,0 +1,77 @@
+//
+// @file: benchExpiryStorm.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Lets a large batch of keys expire at the same moment and measures the put()
+// latency right after it: with unbounded inline expiry, with a bounded expiry
+// budget per operation, with the expiry handed to an ExpiryReaper, and for a
+// map bounded to the storm's size, where every put() is over the bound and
+// must purge or evict just enough to stay within it. The maps run on a
+// ManualClock, so the storm arrives the moment the clock is advanced past
+// the deadline, without waiting for it.
+
+#include "ConcurrentExpiringMap.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+static const long storm_keys = 1000000;
+static const long probe_puts = 100000;
+static const long storm_ttl = 2000;
+
+// fills the map with keys that all expire at the same millisecond, moves the
+// clock past it, then times each of the following puts
+template<typename Map>
+void bench_storm(const char* name, Map& emap) {
+	for (long key = 0; key < storm_keys; ++key) emap.put(key, key, storm_ttl);
+	pj4dev::ManualClock::advance(storm_ttl + 1);
+
+	auto lat = std::vector<double>{};
+	lat.reserve(probe_puts);
+	for (long key = 0; key < probe_puts; ++key) {
+		auto start = std::chrono::steady_clock::now();
+		emap.put(storm_keys + key, key, 60000);
+		lat.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(lat.begin(), lat.end());
+	auto at = [&lat](double q) { return lat[static_cast<size_t>(q * (lat.size() - 1))]; };
+	std::cout << name << ": put() us after " << storm_keys << " keys expired:"
+		<< " p50 " << at(0.5) << ", p99 " << at(0.99) << ", p999 " << at(0.999)
+		<< ", max " << lat.back() << std::endl;
+}
+
+template<typename Expiry>
+void bench_budget(const char* name, size_t budget) {
+	pj4dev::ExpiringMap<long, long, Expiry, pj4dev::ManualClock> emap;
+	emap.set_expiry_budget(budget);
+	bench_storm(name, emap);
+}
+
+template<typename Expiry>
+void bench_bounded(const char* name, size_t budget) {
+	pj4dev::ExpiringMap<long, long, Expiry, pj4dev::ManualClock, pj4dev::LruEviction> emap;
+	emap.set_capacity(storm_keys);
+	emap.set_expiry_budget(budget);
+	bench_storm(name, emap);
+}
+
+int main() {
+	bench_budget<pj4dev::HeapExpiry>("heap,  unbounded ", pj4dev::expire_all);
+	bench_budget<pj4dev::HeapExpiry>("heap,  budget 16 ", 16);
+	bench_budget<pj4dev::HeapExpiry>("heap,  budget 256", 256);
+	bench_budget<pj4dev::WheelExpiry>("wheel, unbounded ", pj4dev::expire_all);
+	bench_budget<pj4dev::WheelExpiry>("wheel, budget 16 ", 16);
+	bench_budget<pj4dev::WheelExpiry>("wheel, budget 256", 256);
+
+	bench_bounded<pj4dev::HeapExpiry>("heap,  lru bound, unbounded ", pj4dev::expire_all);
+	bench_bounded<pj4dev::HeapExpiry>("heap,  lru bound, budget 0  ", 0);
+	bench_bounded<pj4dev::WheelExpiry>("wheel, lru bound, unbounded ", pj4dev::expire_all);
+	bench_bounded<pj4dev::WheelExpiry>("wheel, lru bound, budget 0  ", 0);
+
+	pj4dev::ConcurrentExpiringMap<long, long, pj4dev::HeapExpiry, std::hash<long>, pj4dev::ManualClock> reaped(1);
+	reaped.start_reaper(std::chrono::milliseconds(1), 10000);
+	bench_storm("heap,  reaper    ", reaped);
+}
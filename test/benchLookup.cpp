@@ -0,0 +1,86 @@
+//
+// @file: benchLookup.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Compares get() hit latency of the tree-based ExpiringMap with the
+// open-addressing ExpiringHashMap on a large key set, the cost of each
+// clock policy on the hash map's get(), and copy-out get() against zero-copy
+// lookup() for large values.
+
+#include "ExpiringHashMap.h"
+#include "ConcurrentExpiringMap.h"
+#include "RcuExpiringMap.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename Map>
+void bench_get(const char* name, const std::vector<long>& keys, const std::vector<long>& probes) {
+	Map emap;
+	for (auto key : keys) emap.put(key, key, 3600000);
+
+	auto sum = 0L;
+	auto start = std::chrono::steady_clock::now();
+	for (auto key : probes) sum += emap.get(key);
+	auto get = elapsed_ms(start);
+	std::cout << name << ": " << get * 1e6 / probes.size() << " ns/get (checksum " << sum << ")" << std::endl;
+}
+
+// reads the first and last byte of each hit, so the cost is the copy (if any)
+template<typename Map>
+void bench_large(const char* name, size_t bytes) {
+	const long n = 512;
+	const long probes = 200000;
+	Map emap;
+	for (long key = 0; key < n; ++key) emap.put(key, std::string(bytes, static_cast<char>('a' + key % 26)), 3600000);
+
+	auto sum = 0L;
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < probes; ++i) {
+		auto value = emap.get(i % n);
+		sum += value.front() + value.back();
+	}
+	auto get = elapsed_ms(start);
+	start = std::chrono::steady_clock::now();
+	for (long i = 0; i < probes; ++i) {
+		if (auto value = emap.lookup(i % n)) sum += value->front() + value->back();
+	}
+	auto lookup = elapsed_ms(start);
+	std::cout << name << ", " << bytes / 1024 << " KB: get " << get * 1e6 / probes << " ns, lookup "
+		<< lookup * 1e6 / probes << " ns (checksum " << sum << ")" << std::endl;
+}
+
+int main() {
+	const size_t n = 1000000;
+	std::mt19937_64 rng(42);
+	std::vector<long> keys(n);
+	for (auto& key : keys) key = static_cast<long>(rng());
+	std::vector<long> probes(4 * n);
+	for (auto& key : probes) key = keys[rng() % n];
+
+	std::cout << "<=== get() hits, " << n << " keys\n";
+	bench_get<pj4dev::ExpiringMap<long, long>>("tree", keys, probes);
+	bench_get<pj4dev::ExpiringHashMap<long, long>>("hash", keys, probes);
+
+	using H = std::hash<long>;
+	using E = std::equal_to<long>;
+	std::cout << "<=== get() hits per clock policy\n";
+	bench_get<pj4dev::ExpiringHashMap<long, long, H, E, pj4dev::HeapExpiry, pj4dev::SystemClock>>("system", keys, probes);
+	bench_get<pj4dev::ExpiringHashMap<long, long, H, E, pj4dev::HeapExpiry, pj4dev::SteadyClock>>("steady", keys, probes);
+	bench_get<pj4dev::ExpiringHashMap<long, long, H, E, pj4dev::HeapExpiry, pj4dev::TscClock>>("tsc   ", keys, probes);
+	bench_get<pj4dev::ExpiringHashMap<long, long, H, E, pj4dev::HeapExpiry, pj4dev::CoarseClock>>("coarse", keys, probes);
+
+	std::cout << "<=== get() copy-out vs lookup() in place, large values\n";
+	for (size_t bytes : {4096, 65536}) {
+		bench_large<pj4dev::ExpiringMap<long, std::string>>("tree      ", bytes);
+		bench_large<pj4dev::ExpiringHashMap<long, std::string>>("hash      ", bytes);
+		bench_large<pj4dev::ConcurrentExpiringMap<long, std::string>>("concurrent", bytes);
+		bench_large<pj4dev::RcuExpiringMap<long, std::string>>("rcu       ", bytes);
+	}
+}
@@ -0,0 +1,207 @@
+//
+// @file: benchMap.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Google Benchmark suite for ExpiringMap's operations, for 1K to 10M keys of
+// three types: int64, short strings (8 characters, stored inline) and long
+// strings (64 characters sharing a prefix, so comparisons read past it).
+// The map runs on a ManualClock, so expiry happens exactly when a benchmark
+// moves the clock and the numbers do not include reading a real clock.
+// Build with `make bench`; run a subset with e.g.
+//     ./benchMap --benchmark_filter='Get.*Int64'
+
+#include "ExpiringMap.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static const long ttl = 600000;
+
+// Key generators: key i of every type is distinct and keys are scattered,
+// so the order they are made in is not the map's order.
+struct Int64Keys {
+	using type = long;
+	static type make(size_t i) { return static_cast<long>((i * 0x9E3779B97F4A7C15ULL) >> 1); }
+};
+
+struct ShortStringKeys {
+	using type = std::string;
+	static type make(size_t i) {
+		char buf[16];
+		std::snprintf(buf, sizeof(buf), "%08llx", static_cast<unsigned long long>(Int64Keys::make(i)) & 0xffffffffULL);
+		return buf;
+	}
+};
+
+struct LongStringKeys {
+	using type = std::string;
+	static type make(size_t i) {
+		char buf[24];
+		std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(Int64Keys::make(i)));
+		return "tenant-0042/session/0123456789abcdef0123456789abcdef/" + std::string(buf, 11);
+	}
+};
+
+template<typename Keys, typename Expiry = pj4dev::HeapExpiry>
+using Map = pj4dev::ExpiringMap<typename Keys::type, long, Expiry, pj4dev::ManualClock>;
+
+// keys first..first+n-1, shuffled
+template<typename Keys>
+static std::vector<typename Keys::type> make_keys(size_t n, size_t first = 0) {
+	auto keys = std::vector<typename Keys::type>{};
+	keys.reserve(n);
+	for (size_t i = 0; i < n; ++i) keys.push_back(Keys::make(first + i));
+	std::shuffle(keys.begin(), keys.end(), std::mt19937_64(n));
+	return keys;
+}
+
+template<typename M, typename K>
+static void fill(M& map, const std::vector<K>& keys, long ms) {
+	for (const auto& key : keys) map.put(key, 1, ms);
+}
+
+// Batch benchmarks: each iteration applies the operation to all n keys.
+
+template<typename Keys>
+static void PutNew(benchmark::State& state) {
+	pj4dev::ManualClock::set(0);
+	auto keys = make_keys<Keys>(static_cast<size_t>(state.range(0)));
+	for (auto _ : state) {
+		Map<Keys> map;
+		fill(map, keys, ttl);
+		state.PauseTiming();
+		map.clear();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<typename Keys>
+static void Erase(benchmark::State& state) {
+	pj4dev::ManualClock::set(0);
+	auto keys = make_keys<Keys>(static_cast<size_t>(state.range(0)));
+	Map<Keys> map;
+	for (auto _ : state) {
+		state.PauseTiming();
+		fill(map, keys, ttl);
+		state.ResumeTiming();
+		for (const auto& key : keys) map.erase(key);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// n keys with TTLs spread over a second, all due by the time expire() runs
+template<typename Keys, typename Expiry>
+static void MassExpiry(benchmark::State& state) {
+	pj4dev::ManualClock::set(0);
+	auto keys = make_keys<Keys>(static_cast<size_t>(state.range(0)));
+	Map<Keys, Expiry> map;
+	std::mt19937_64 rng(7);
+	for (auto _ : state) {
+		state.PauseTiming();
+		for (const auto& key : keys) map.put(key, 1, 1 + static_cast<long>(rng() % 1000));
+		pj4dev::ManualClock::advance(1001);
+		state.ResumeTiming();
+		benchmark::DoNotOptimize(map.expire());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+template<typename Keys>
+static void KeysSorted(benchmark::State& state) {
+	pj4dev::ManualClock::set(0);
+	auto keys = make_keys<Keys>(static_cast<size_t>(state.range(0)));
+	Map<Keys> map;
+	fill(map, keys, ttl);
+	for (auto _ : state) benchmark::DoNotOptimize(map.keys());
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Single-operation benchmarks: each iteration is one call on a map of n keys.
+
+template<typename Keys>
+static void PutOverwrite(benchmark::State& state) {
+	pj4dev::ManualClock::set(0);
+	auto keys = make_keys<Keys>(static_cast<size_t>(state.range(0)));
+	Map<Keys> map;
+	fill(map, keys, ttl);
+	size_t i = 0;
+	for (auto _ : state) {
+		map.put(keys[i], 2, ttl);
+		if (++i == keys.size()) i = 0;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+// get() on a map of n keys, of keys in the map or of other keys, live or
+// expired
+template<typename Keys>
+static void get_loop(benchmark::State& state, bool hit, bool expired) {
+	pj4dev::ManualClock::set(0);
+	auto n = static_cast<size_t>(state.range(0));
+	auto keys = make_keys<Keys>(n);
+	Map<Keys> map;
+	fill(map, keys, ttl);
+	// get() purges nothing with the default budget, so expired keys stay put
+	if (expired) pj4dev::ManualClock::advance(ttl + 1);
+	auto probes = hit ? keys : make_keys<Keys>(n, n);
+	size_t i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(map.get(probes[i]));
+		if (++i == probes.size()) i = 0;
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Keys>
+static void GetHit(benchmark::State& state) { get_loop<Keys>(state, true, false); }
+
+template<typename Keys>
+static void GetMiss(benchmark::State& state) { get_loop<Keys>(state, false, false); }
+
+template<typename Keys>
+static void GetExpired(benchmark::State& state) { get_loop<Keys>(state, true, true); }
+
+template<typename Keys>
+static void Size(benchmark::State& state) {
+	pj4dev::ManualClock::set(0);
+	auto keys = make_keys<Keys>(static_cast<size_t>(state.range(0)));
+	Map<Keys> map;
+	fill(map, keys, ttl);
+	for (auto _ : state) benchmark::DoNotOptimize(map.size());
+	state.SetItemsProcessed(state.iterations());
+}
+
+// 1K to 10M keys, per call or per batch of all keys
+static void per_call(benchmark::internal::Benchmark* b) {
+	b->RangeMultiplier(10)->Range(1000, 10000000);
+}
+
+static void per_batch(benchmark::internal::Benchmark* b) {
+	b->RangeMultiplier(10)->Range(1000, 10000000)->Unit(benchmark::kMillisecond);
+}
+
+// registers a benchmark for each key type
+#define BENCH_KEYS(sizes, bench, ...) \
+	BENCHMARK_TEMPLATE(bench, Int64Keys, ##__VA_ARGS__)->Apply(sizes); \
+	BENCHMARK_TEMPLATE(bench, ShortStringKeys, ##__VA_ARGS__)->Apply(sizes); \
+	BENCHMARK_TEMPLATE(bench, LongStringKeys, ##__VA_ARGS__)->Apply(sizes)
+
+BENCH_KEYS(per_batch, PutNew);
+BENCH_KEYS(per_call, PutOverwrite);
+BENCH_KEYS(per_call, GetHit);
+BENCH_KEYS(per_call, GetMiss);
+BENCH_KEYS(per_call, GetExpired);
+BENCH_KEYS(per_batch, Erase);
+BENCH_KEYS(per_batch, KeysSorted);
+BENCH_KEYS(per_call, Size);
+BENCH_KEYS(per_batch, MassExpiry, pj4dev::HeapExpiry);
+BENCH_KEYS(per_batch, MassExpiry, pj4dev::WheelExpiry);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,72 @@
+//
+// @file: benchRcu.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Measures get() throughput of reader threads while one writer thread keeps
+// overwriting keys in bursts, for the sharded ConcurrentExpiringMap and for
+// the lock-free read path of RcuExpiringMap.
+
+#include "ConcurrentExpiringMap.h"
+#include "RcuExpiringMap.h"
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+
+static const long key_space = 100000;
+
+template<typename Map>
+void bench_read_mostly(const char* name, Map& emap, unsigned readers, bool writing) {
+	for (long key = 0; key < key_space; ++key) emap.put(key, key, 60000);
+
+	std::atomic<bool> done{false};
+	std::atomic<long> reads{0}, writes{0};
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < readers; ++t) {
+		threads.emplace_back([&, t]() {
+			std::mt19937_64 rng(t);
+			auto n = 0L, sum = 0L;
+			while (!done) {
+				sum += emap.get(static_cast<long>(rng() % key_space));
+				++n;
+			}
+			reads += n;
+			if (sum == -1) std::cout << sum; // keep the reads alive
+		});
+	}
+	if (writing) {
+		threads.emplace_back([&]() {
+			std::mt19937_64 rng(99);
+			auto n = 0L;
+			while (!done) {
+				// a burst of 1000 writes, then a short pause
+				for (int i = 0; i < 1000; ++i, ++n) {
+					auto key = static_cast<long>(rng() % key_space);
+					emap.put(key, key, 60000);
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			writes += n;
+		});
+	}
+	std::this_thread::sleep_for(std::chrono::seconds(1));
+	done = true;
+	for (auto& thread : threads) thread.join();
+	std::cout << name << " x" << readers << (writing ? " with writer: " : ":             ")
+		<< reads / 1e6 << " M reads/s, " << writes / 1e3 << " K writes/s" << std::endl;
+}
+
+int main() {
+	auto max_readers = std::max(2U, std::thread::hardware_concurrency());
+	for (unsigned readers = 1; readers <= max_readers; readers *= 2) {
+		for (auto writing : {false, true}) {
+			pj4dev::ConcurrentExpiringMap<long, long> sharded;
+			bench_read_mostly("sharded", sharded, readers, writing);
+			pj4dev::RcuExpiringMap<long, long> rcu(key_space);
+			bench_read_mostly("rcu    ", rcu, readers, writing);
+		}
+	}
+}
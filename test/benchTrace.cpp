@@ -0,0 +1,408 @@
+//
+// @file: benchTrace.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+//
+// Generates workload traces and replays them against ExpiringMap, to compare
+// the expiry policies under a realistic mix instead of one operation at a
+// time. A trace is a sequence of get, put, erase and touch operations with
+// keys drawn from a Zipfian (or, with skew=0, uniform) distribution, TTLs
+// drawn from a configurable distribution and a simulated timestamp per
+// operation. The replay runs on a ManualClock set to each timestamp, so an
+// hour of traffic takes seconds and runs the same on every machine.
+//
+// For each policy the replay prints the throughput, the latency percentiles
+// of each operation, the peak memory (memory_usage() of the map and the
+// process's peak RSS) and the staleness of the expiry index: how many of the
+// elements the map holds have expired without being purged yet, sampled
+// every simulated second. A last run repeats the heap's with CountingStats,
+// to show what the map counts itself and what counting costs.
+//
+//     ./benchTrace [options]                 generate a trace and replay it
+//     ./benchTrace generate FILE [options]   write a trace to FILE
+//     ./benchTrace replay FILE [budget=N]    replay the trace in FILE
+//
+// Options (defaults in brackets):
+//     ops=N         operations [2000000]
+//     keys=N        distinct keys [100000]
+//     skew=S        Zipf exponent, 0 for uniform keys [0.99]
+//     rate=N        operations per simulated second [5000]
+//     mix=SPEC      weights of the operations [get:70,put:20,erase:5,touch:5]
+//     ttl=SPEC      TTL distribution, in ms [choice:5000@50,60000@40,600000@10]
+//                   fixed:MS | uniform:MIN:MAX | exp:MEAN | choice:MS@W,MS@W,...
+//     seed=N        random seed [42]
+//     budget=N      expired elements a put() or get() may purge, see
+//                   set_expiry_budget() [all]
+
+#include "ExpiringMap.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <map>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+enum class Op : std::uint8_t { get, put, erase, touch };
+static const char* const op_names[] = { "get", "put", "erase", "touch" };
+
+// one operation of a trace, as stored in a trace file
+struct Record {
+	std::int64_t time;  // simulated ms since the start of the trace
+	std::int64_t key;
+	std::int32_t ttl;   // ms, for put and touch
+	Op op;
+};
+
+static const char trace_magic[8] = { 'P', 'J', 'T', 'R', 'A', 'C', 'E', '1' };
+
+using Options = std::map<std::string, std::string>;
+
+static const Options defaults = {
+	{ "ops", "2000000" },
+	{ "keys", "100000" },
+	{ "skew", "0.99" },
+	{ "rate", "5000" },
+	{ "mix", "get:70,put:20,erase:5,touch:5" },
+	{ "ttl", "choice:5000@50,60000@40,600000@10" },
+	{ "seed", "42" },
+	{ "budget", "all" }
+};
+
+static std::string option(const Options& opts, const char* name) {
+	auto it = opts.find(name);
+	return it == opts.end() ? defaults.at(name) : it->second;
+}
+
+static std::vector<std::string> split(const std::string& s, char sep) {
+	auto parts = std::vector<std::string>{};
+	std::istringstream in(s);
+	for (std::string part; std::getline(in, part, sep);) parts.push_back(part);
+	return parts;
+}
+
+static double number(const std::string& s) {
+	char* end = nullptr;
+	auto value = std::strtod(s.c_str(), &end);
+	if (s.empty() || *end) throw std::invalid_argument("not a number: " + s);
+	return value;
+}
+
+// Draws TTLs from a distribution given as fixed:MS, uniform:MIN:MAX,
+// exp:MEAN or choice:MS@WEIGHT,MS@WEIGHT,...
+class TtlDistribution {
+public:
+	explicit TtlDistribution(const std::string& spec) {
+		auto parts = split(spec, ':');
+		kind_ = parts[0];
+		if (kind_ == "fixed" && parts.size() == 2) {
+			a_ = number(parts[1]);
+		} else if (kind_ == "uniform" && parts.size() == 3) {
+			a_ = number(parts[1]);
+			b_ = number(parts[2]);
+		} else if (kind_ == "exp" && parts.size() == 2) {
+			a_ = number(parts[1]);
+		} else if (kind_ == "choice" && parts.size() == 2) {
+			auto weights = std::vector<double>{};
+			for (const auto& choice : split(parts[1], ',')) {
+				auto ms_weight = split(choice, '@');
+				if (ms_weight.size() != 2) throw std::invalid_argument("bad ttl choice: " + choice);
+				choices_.push_back(number(ms_weight[0]));
+				weights.push_back(number(ms_weight[1]));
+			}
+			pick_ = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+		} else {
+			throw std::invalid_argument("bad ttl: " + spec);
+		}
+	}
+
+	std::int32_t operator()(std::mt19937_64& rng) {
+		auto ms = a_;
+		if (kind_ == "uniform") ms = std::uniform_real_distribution<double>(a_, b_)(rng);
+		else if (kind_ == "exp") ms = std::exponential_distribution<double>(1.0 / a_)(rng);
+		else if (kind_ == "choice") ms = choices_[pick_(rng)];
+		return static_cast<std::int32_t>(std::max(1.0, std::min(ms, 2e9)));
+	}
+
+private:
+	std::string kind_;
+	double a_ = 0;
+	double b_ = 0;
+	std::vector<double> choices_;
+	std::discrete_distribution<size_t> pick_;
+};
+
+// keys drawn with P(rank r) proportional to 1 / r^skew, ranks scattered over
+// the key space so that popular keys are not neighbours in the map
+class KeyDistribution {
+public:
+	KeyDistribution(size_t keys, double skew) : keys_(keys), cdf_(skew > 0 ? keys : 0) {
+		auto sum = 0.0;
+		for (size_t r = 0; r < cdf_.size(); ++r) cdf_[r] = sum += 1.0 / std::pow(static_cast<double>(r + 1), skew);
+		uniform_ = std::uniform_real_distribution<double>(0.0, sum);
+	}
+
+	std::int64_t operator()(std::mt19937_64& rng) {
+		auto rank = cdf_.empty() ? rng() % keys_
+			: static_cast<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), uniform_(rng)) - cdf_.begin());
+		return static_cast<std::int64_t>((rank * 2654435761ULL) % keys_);
+	}
+
+private:
+	size_t keys_;
+	std::vector<double> cdf_;
+	std::uniform_real_distribution<double> uniform_;
+};
+
+static std::vector<Record> generate(const Options& opts) {
+	auto ops = static_cast<size_t>(number(option(opts, "ops")));
+	auto keys = static_cast<size_t>(number(option(opts, "keys")));
+	auto rate = number(option(opts, "rate"));
+	if (!keys || rate <= 0) throw std::invalid_argument("keys and rate must be positive");
+	KeyDistribution key(keys, number(option(opts, "skew")));
+	TtlDistribution ttl(option(opts, "ttl"));
+
+	auto weights = std::vector<double>(4);
+	for (const auto& entry : split(option(opts, "mix"), ',')) {
+		auto name_weight = split(entry, ':');
+		if (name_weight.size() != 2) throw std::invalid_argument("bad mix: " + entry);
+		auto op = std::find(std::begin(op_names), std::end(op_names), name_weight[0]);
+		if (op == std::end(op_names)) throw std::invalid_argument("bad mix: " + entry);
+		weights[static_cast<size_t>(op - std::begin(op_names))] = number(name_weight[1]);
+	}
+	std::discrete_distribution<int> op(weights.begin(), weights.end());
+
+	std::mt19937_64 rng(static_cast<std::uint64_t>(number(option(opts, "seed"))));
+	auto trace = std::vector<Record>(ops);
+	for (size_t i = 0; i < ops; ++i) {
+		auto& r = trace[i];
+		r.time = static_cast<std::int64_t>(static_cast<double>(i) * 1000.0 / rate);
+		r.op = static_cast<Op>(op(rng));
+		r.key = key(rng);
+		r.ttl = r.op == Op::put || r.op == Op::touch ? ttl(rng) : 0;
+	}
+	return trace;
+}
+
+static void write_trace(const std::string& path, const std::vector<Record>& trace) {
+	std::ofstream out(path, std::ios::binary);
+	auto count = static_cast<std::uint64_t>(trace.size());
+	out.write(trace_magic, sizeof(trace_magic));
+	out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	out.write(reinterpret_cast<const char*>(trace.data()), static_cast<std::streamsize>(trace.size() * sizeof(Record)));
+	if (!out) throw std::runtime_error("cannot write " + path);
+}
+
+static std::vector<Record> read_trace(const std::string& path) {
+	std::ifstream in(path, std::ios::binary);
+	char magic[sizeof(trace_magic)] = {};
+	auto count = std::uint64_t{0};
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char*>(&count), sizeof(count));
+	if (!in || !std::equal(magic, magic + sizeof(magic), trace_magic)) throw std::runtime_error("not a trace: " + path);
+	auto trace = std::vector<Record>(count);
+	in.read(reinterpret_cast<char*>(trace.data()), static_cast<std::streamsize>(count * sizeof(Record)));
+	if (!in) throw std::runtime_error("truncated trace: " + path);
+	return trace;
+}
+
+// Latencies in log-linear buckets, as HdrHistogram keeps them: sixteen
+// buckets per power of two, so every value is recorded within 6%.
+class Histogram {
+public:
+	void record(std::uint64_t ns) {
+		++counts_[bucket(ns)];
+		++count_;
+		max_ = std::max(max_, ns);
+	}
+
+	std::uint64_t percentile(double q) const {
+		auto rank = static_cast<std::uint64_t>(std::ceil(q / 100.0 * static_cast<double>(count_)));
+		auto seen = std::uint64_t{0};
+		for (size_t i = 0; i < counts_.size(); ++i) {
+			seen += counts_[i];
+			if (seen >= rank && seen) return std::min(lowest(i + 1) - 1, max_);
+		}
+		return max_;
+	}
+
+	std::uint64_t count() const noexcept { return count_; }
+	std::uint64_t max() const noexcept { return max_; }
+
+private:
+	static size_t bucket(std::uint64_t v) noexcept {
+		if (v < 16) return static_cast<size_t>(v);
+		auto e = 63 - __builtin_clzll(v);
+		return static_cast<size_t>((e - 3) * 16) + static_cast<size_t>((v >> (e - 4)) & 15);
+	}
+
+	// the smallest value in bucket i
+	static std::uint64_t lowest(size_t i) noexcept {
+		if (i < 16) return i;
+		return (16 + i % 16) << (i / 16 - 1);
+	}
+
+	std::vector<std::uint64_t> counts_ = std::vector<std::uint64_t>(61 * 16);
+	std::uint64_t count_ = 0;
+	std::uint64_t max_ = 0;
+};
+
+// the process's peak resident set in kB since the last reset_peak_rss(), or
+// 0 where /proc does not report it
+static long peak_rss_kb() {
+	std::ifstream status("/proc/self/status");
+	for (std::string line; std::getline(status, line);) {
+		if (line.compare(0, 6, "VmHWM:") == 0) return std::strtol(line.c_str() + 6, nullptr, 10);
+	}
+	return 0;
+}
+
+static void reset_peak_rss() {
+	std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// what the map counted itself, with CountingStats
+template<typename Map>
+void print_stats(const Map&, std::false_type) {}
+
+template<typename Map>
+void print_stats(const Map& emap, std::true_type) {
+	auto st = emap.stats();
+	auto biggest = 0;
+	for (int i = 0; i < 64; ++i) if (st.purge_batches[i]) biggest = i;
+	std::cout << "  stats(): " << st.hits << " hits, " << st.misses << " misses, " << st.expired_reads
+		<< " expired reads, " << st.inserts << " inserts, " << st.overwrites << " overwrites, " << st.purged
+		<< " purged in " << st.purges << " purges of up to " << (2UL << biggest) - 1 << ", get p99 "
+		<< st.get_latency.percentile(99) << " ns, put p99 " << st.put_latency.percentile(99) << " ns, "
+		<< st.index_entries << " index entries\n";
+}
+
+template<typename Expiry, typename Stats = pj4dev::NoStats>
+void replay(const char* name, const std::vector<Record>& trace, size_t budget) {
+	using clock = std::chrono::steady_clock;
+	reset_peak_rss();
+	pj4dev::ManualClock::set(0);
+	pj4dev::ExpiringMap<std::int64_t, std::int64_t, Expiry, pj4dev::ManualClock, pj4dev::NoEviction, Stats> emap;
+	emap.set_expiry_budget(budget);
+
+	Histogram latency[4];
+	size_t hits[4] = {};
+	auto peak_bytes = size_t{0};
+	auto peak_stale = size_t{0};
+	auto stale_sum = 0.0;
+	auto samples = size_t{0};
+	auto next_sample = std::int64_t{1000};
+	auto busy = clock::duration::zero();
+
+	auto start = clock::now();
+	for (const auto& r : trace) {
+		if (r.time >= next_sample) {
+			// counting what is live walks the map without purging anything
+			auto sampled = clock::now();
+			auto mu = emap.memory_usage();
+			auto live = size_t{0};
+			emap.for_each_live([&live](const std::int64_t&, const std::int64_t&) { ++live; });
+			auto stale = mu.entries - live;
+			peak_bytes = std::max(peak_bytes, mu.total());
+			peak_stale = std::max(peak_stale, stale);
+			stale_sum += mu.entries ? static_cast<double>(stale) / static_cast<double>(mu.entries) : 0.0;
+			++samples;
+			next_sample += 1000;
+			busy += clock::now() - sampled;
+		}
+		pj4dev::ManualClock::set(r.time);
+		auto op_start = clock::now();
+		auto hit = false;
+		switch (r.op) {
+		case Op::get: hit = static_cast<bool>(emap.lookup(r.key)); break;
+		case Op::put: emap.put(r.key, r.key, r.ttl); hit = true; break;
+		case Op::erase: emap.erase(r.key); hit = true; break;
+		case Op::touch: hit = emap.touch(r.key, r.ttl); break;
+		}
+		auto op_end = clock::now();
+		latency[static_cast<int>(r.op)].record(static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(op_end - op_start).count()));
+		hits[static_cast<int>(r.op)] += hit;
+	}
+	auto secs = std::chrono::duration<double>(clock::now() - start - busy).count();
+
+	auto sim_secs = trace.empty() ? 0.0 : static_cast<double>(trace.back().time) / 1000.0;
+	std::cout << "<=== " << name << ": " << trace.size() << " ops over " << sim_secs << " simulated s in "
+		<< secs << " s, " << static_cast<double>(trace.size()) / secs / 1e6 << " Mops/s\n";
+	for (int op = 0; op < 4; ++op) {
+		const auto& h = latency[op];
+		if (!h.count()) continue;
+		std::cout << "  " << op_names[op] << ": " << h.count() << " ops";
+		if (static_cast<Op>(op) == Op::get || static_cast<Op>(op) == Op::touch)
+			std::cout << ", " << 100.0 * static_cast<double>(hits[op]) / static_cast<double>(h.count()) << "% live";
+		std::cout << ", ns p50 " << h.percentile(50) << ", p90 " << h.percentile(90) << ", p99 "
+			<< h.percentile(99) << ", p99.9 " << h.percentile(99.9) << ", max " << h.max() << "\n";
+	}
+	auto mu = emap.memory_usage();
+	std::cout << "  memory: peak " << peak_bytes << " B in the map, peak RSS " << peak_rss_kb() << " kB; at the end "
+		<< mu.entries << " entries, " << mu.total() << " B\n";
+	std::cout << "  staleness: expired but not purged, peak " << peak_stale << " entries, mean "
+		<< (samples ? 100.0 * stale_sum / static_cast<double>(samples) : 0.0) << "% of the map over "
+		<< samples << " samples" << std::endl;
+	print_stats(emap, std::integral_constant<bool, Stats::recorder::enabled>{});
+}
+
+static void replay_all(const std::vector<Record>& trace, const Options& opts) {
+	auto spec = option(opts, "budget");
+	auto budget = spec == "all" ? pj4dev::expire_all : static_cast<size_t>(number(spec));
+	replay<pj4dev::HeapExpiry>("heap ", trace, budget);
+	replay<pj4dev::WheelExpiry>("wheel", trace, budget);
+	replay<pj4dev::HeapExpiry, pj4dev::CountingStats>("heap, CountingStats", trace, budget);
+}
+
+static void usage() {
+	std::cerr << "usage: benchTrace [options]\n"
+		"       benchTrace generate FILE [options]\n"
+		"       benchTrace replay FILE [budget=N]\n"
+		"options: ops=N keys=N skew=S rate=N mix=get:W,put:W,erase:W,touch:W seed=N budget=N\n"
+		"         ttl=fixed:MS | uniform:MIN:MAX | exp:MEAN | choice:MS@W,MS@W,...\n";
+}
+
+int main(int argc, char** argv) {
+	auto args = std::vector<std::string>(argv + 1, argv + argc);
+	auto command = std::string{};
+	auto path = std::string{};
+	if (!args.empty() && (args[0] == "generate" || args[0] == "replay")) {
+		if (args.size() < 2) { usage(); return 1; }
+		command = args[0];
+		path = args[1];
+		args.erase(args.begin(), args.begin() + 2);
+	}
+	Options opts;
+	for (const auto& arg : args) {
+		auto eq = arg.find('=');
+		if (eq == std::string::npos || !defaults.count(arg.substr(0, eq))) { usage(); return 1; }
+		opts[arg.substr(0, eq)] = arg.substr(eq + 1);
+	}
+
+	try {
+		if (command == "generate") {
+			write_trace(path, generate(opts));
+		} else if (command == "replay") {
+			replay_all(read_trace(path), opts);
+		} else {
+			auto trace = generate(opts);
+			std::cout << "trace:";
+			for (const auto& d : defaults) std::cout << " " << d.first << "=" << option(opts, d.first.c_str());
+			std::cout << "\n";
+			replay_all(trace, opts);
+		}
+	} catch (const std::exception& e) {
+		std::cerr << "benchTrace: " << e.what() << "\n";
+		usage();
+		return 1;
+	}
+}
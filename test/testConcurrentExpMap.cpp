@@ -0,0 +1,42 @@
+//
+// @file: testConcurrentExpMap.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+
+#include "ConcurrentExpiringMap.h"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+typedef pj4dev::ConcurrentExpiringMap<std::string, int> ExpMap;
+
+int main() {
+	ExpMap emap(8);
+	std::vector<std::thread> writers;
+	for (int t = 0; t < 4; ++t) {
+		writers.emplace_back([&emap, t]() {
+			for (int i = 0; i < 1000; ++i)
+				emap.put("key-" + std::to_string(t) + "-" + std::to_string(i), i, i < 500 ? 500 : 5000);
+		});
+	}
+	for (auto& writer : writers) writer.join();
+	std::cout << "<=== after 4 threads inserted 1000 keys each into " << emap.shards() << " shards\n";
+	std::cout << "size = " << emap.size() << std::endl;
+	std::cout << "key-2-700 = " << emap.get("key-2-700") << std::endl;
+	if (auto value = emap.lookup("key-2-700")) std::cout << "lookup key-2-700 = " << *value << std::endl;
+
+	sleep(1);
+	std::cout << "<=== after sleep 1s\n";
+	std::cout << "size = " << emap.size() << ", keys = " << emap.keys().size() << std::endl;
+	std::cout << "key-2-100 = " << emap.get("key-2-100") << std::endl;
+
+	emap.erase("key-2-700");
+	std::cout << "<=== after delete key-2-700\n";
+	std::cout << "size = " << emap.size() << std::endl;
+
+	emap.clear();
+	std::cout << "<=== after clear()\n";
+	std::cout << "size = " << emap.size() << std::endl;
+}
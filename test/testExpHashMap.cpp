@@ -0,0 +1,76 @@
+//
+// @file: testExpHashMap.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+
+#include "ExpiringHashMap.h"
+
+#include <iostream>
+#include <iterator>
+
+typedef pj4dev::ExpiringHashMap<std::string, int, std::hash<std::string>,
+	std::equal_to<std::string>, pj4dev::HeapExpiry, pj4dev::ManualClock> ExpMap;
+
+// the map runs on a manual clock, so each step below is exact and instant
+static void advance(long secs) { pj4dev::ManualClock::advance(secs * 1000); }
+
+void verbose(const ExpMap emap) {
+	std::cout << "size = " << emap.size() << std::endl;
+	std::cout << "hello = " << emap.get("hello") << "(left: " << emap.left("hello") << ")" << std::endl;
+	std::cout << "world = " << emap.get("world") << "(left: " << emap.left("world") << ")" << std::endl;
+
+}
+
+int main() {
+	ExpMap emap;
+	emap.put("hello", 1, 500);
+	emap.put("world", 2, 100);
+	std::cout << "<=== after inserting 'hello' and 'world'\n";
+	verbose(emap);
+
+	emap.put("world", 2, 3000);
+	advance(1);
+	std::cout << "<=== after inserting new 'world' and advancing 1s\n";
+	verbose(emap);
+
+	advance(3);
+	std::cout << "<=== after advancing 3s\n";
+	verbose(emap);
+
+	emap.put("hello", 11, 50000);
+	emap.put("world", 12, 40000);
+	std::cout << "<=== after add new 'hello' and 'world'\n";
+	verbose(emap);
+
+	auto keys = emap.keys();
+	std::cout << "<=== after get keys\n";
+	std::copy(keys.cbegin(), keys.cend(), std::ostream_iterator<decltype(*keys.cbegin())>(std::cout, " "));
+	std::cout << std::endl;
+
+	emap.erase("hello");
+	std::cout << "<=== after delete hello\n";
+	verbose(emap);
+
+	advance(2);
+	std::cout << "<=== after advancing 2s\n";
+	verbose(emap);
+
+	emap.touch("world", 60000);
+	std::cout << "<=== after touch world for 60s\n";
+	verbose(emap);
+
+	emap.clear();
+	std::cout << "<=== after clear()\n";
+	verbose(emap);
+
+	// a value overwritten with itself is reported once the copy is in place
+	pj4dev::ExpiringHashMap<std::string, std::string, std::hash<std::string>,
+		std::equal_to<std::string>, pj4dev::HeapExpiry, pj4dev::ManualClock> names;
+	names.set_eviction_listener([](std::vector<pj4dev::Eviction<std::string, std::string>>& evicted) {
+		for (const auto& e : evicted) std::cout << "evicted " << e.key << " = " << e.value << std::endl;
+	});
+	names.put("greeting", "hello", 1000);
+	names.put("greeting", *names.lookup("greeting"), 2000);
+	std::cout << "<=== after overwriting greeting with itself\n";
+	std::cout << "greeting = " << names.get("greeting") << "(left: " << names.left("greeting") << ")" << std::endl;
+}
@@ -6,10 +6,22 @@
 #include "ExpiringMap.h"
 
 #include <iostream>
-#include <ctime>
 #include <iterator>
 
-typedef pj4dev::ExpiringMap<std::string, int> ExpMap;
+typedef pj4dev::ExpiringMap<std::string, int, pj4dev::HeapExpiry, pj4dev::ManualClock> ExpMap;
+
+static const char* reason_name(pj4dev::EvictionReason reason) {
+	switch (reason) {
+	case pj4dev::EvictionReason::expired: return "expired";
+	case pj4dev::EvictionReason::erased: return "erased";
+	case pj4dev::EvictionReason::replaced: return "replaced";
+	case pj4dev::EvictionReason::capacity: return "capacity";
+	}
+	return "";
+}
+
+// the map runs on a manual clock, so each step below is exact and instant
+static void advance(long secs) { pj4dev::ManualClock::advance(secs * 1000); }
 
 void verbose(const ExpMap emap) {
 	std::cout << "size = " << emap.size() << std::endl;
@@ -20,39 +32,67 @@ void verbose(const ExpMap emap) {
 
 int main() {
 	ExpMap emap;
+	emap.set_eviction_listener([](std::vector<pj4dev::Eviction<std::string, int>>& evicted) {
+		for (const auto& e : evicted)
+			std::cout << "evicted " << e.key << " = " << e.value << " (" << reason_name(e.reason) << ")" << std::endl;
+	});
 	emap.put("hello", 1, 500);
 	emap.put("world", 2, 100);
 	std::cout << "<=== after inserting 'hello' and 'world'\n";
 	verbose(emap);
 
 	emap.put("world", 2, 3000);
-	sleep(1);
-	std::cout << "<=== after inserting new 'world' and sleep 1s\n";
+	advance(1);
+	std::cout << "<=== after inserting new 'world' and advancing 1s\n";
 	verbose(emap);
 
-	sleep(3);
-	std::cout << "<=== after sleep 3s\n";
+	advance(3);
+	std::cout << "<=== after advancing 3s\n";
 	verbose(emap);
 
 	emap.put("hello", 11, 50000);
 	emap.put("world", 12, 40000);
 	std::cout << "<=== after add new 'hello' and 'world'\n";
 	verbose(emap);
+	std::cout << "next expiry = " << emap.next_expiry() << std::endl;
+	emap.expiring_within(45000, [](const std::string& key, int value) {
+		std::cout << "expiring within 45s: " << key << " = " << value << std::endl;
+	});
 
 	auto keys = emap.keys();
 	std::cout << "<=== after get keys\n";
 	std::copy(keys.cbegin(), keys.cend(), std::ostream_iterator<decltype(*keys.cbegin())>(std::cout, " "));
 	std::cout << std::endl;
+	std::cout << "stream:";
+	for (const auto& key : emap.key_stream()) std::cout << " " << key;
+	std::cout << std::endl;
+	for (const auto& entry : emap) std::cout << entry.first << " = " << entry.second << std::endl;
+	if (auto hello = emap.lookup("hello")) std::cout << "lookup hello = " << *hello << std::endl;
 
 	emap.erase("hello");
 	std::cout << "<=== after delete hello\n";
 	verbose(emap);
 
-	sleep(2);
-	std::cout << "<=== after sleep 2s\n";
+	advance(2);
+	std::cout << "<=== after advancing 2s\n";
+	verbose(emap);
+
+	emap.touch("world", 60000);
+	std::cout << "<=== after touch world for 60s\n";
 	verbose(emap);
 
 	emap.clear();
 	std::cout << "<=== after clear()\n";
 	verbose(emap);
+
+	// a value overwritten with itself is reported once the copy is in place
+	pj4dev::ExpiringMap<std::string, std::string, pj4dev::HeapExpiry, pj4dev::ManualClock> names;
+	names.set_eviction_listener([](std::vector<pj4dev::Eviction<std::string, std::string>>& evicted) {
+		for (const auto& e : evicted)
+			std::cout << "evicted " << e.key << " = " << e.value << " (" << reason_name(e.reason) << ")" << std::endl;
+	});
+	names.put("greeting", "hello", 1000);
+	names.put("greeting", *names.lookup("greeting"), 2000);
+	std::cout << "<=== after overwriting greeting with itself\n";
+	std::cout << "greeting = " << names.get("greeting") << "(left: " << names.left("greeting") << ")" << std::endl;
 }
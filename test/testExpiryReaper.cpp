@@ -0,0 +1,68 @@
+//
+// @file: testExpiryReaper.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+
+#include "ConcurrentExpiringMap.h"
+#include "RcuExpiringMap.h"
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+int main() {
+	pj4dev::ExpiryReaper reaper(std::chrono::milliseconds(10), 2000);
+	pj4dev::ConcurrentExpiringMap<std::string, int> sharded(8);
+	pj4dev::RcuExpiringMap<std::string, int> rcu(1024);
+	sharded.attach(reaper);
+	rcu.attach(reaper);
+
+	for (int i = 0; i < 20000; ++i) {
+		sharded.put("key-" + std::to_string(i), i, 200);
+		rcu.put("key-" + std::to_string(i), i, 200);
+	}
+	sharded.put("hello", 1, 5000);
+	rcu.put("hello", 1, 5000);
+	std::cout << "<=== after inserting 20001 keys into two maps sharing a reaper\n";
+	std::cout << "reaped = " << reaper.reaped() << std::endl;
+
+	usleep(500000);
+	std::cout << "<=== after sleep 0.5s (2000 entries per map per 10ms tick)\n";
+	std::cout << "reaped = " << reaper.reaped() << std::endl;
+	std::cout << "sharded size = " << sharded.size() << ", hello = " << sharded.get("hello") << std::endl;
+	std::cout << "rcu size = " << rcu.size() << ", hello = " << rcu.get("hello") << std::endl;
+
+	sharded.detach();
+	sharded.start_reaper(std::chrono::milliseconds(5), 100);
+	sharded.put("world", 2, 100);
+	usleep(300000);
+	std::cout << "<=== after switching to an owned reaper and sleep 0.3s\n";
+	std::cout << "sharded size = " << sharded.size() << ", world = " << sharded.get("world") << std::endl;
+
+	// a task runs outside the reaper's lock, so it may call the reaper
+	std::atomic<bool> called{false};
+	auto task = reaper.add([&reaper, &called](size_t) -> size_t {
+		reaper.reaped();
+		called = true;
+		return 0;
+	});
+	usleep(100000);
+	reaper.remove(task);
+	std::cout << "<=== after a task called the reaper it runs on\n";
+	std::cout << "task called reaped() = " << (called ? "yes" : "no") << std::endl;
+
+	// a listener runs on the reaper's thread, outside its lock, so it may
+	// detach its own map from the reaper
+	pj4dev::ConcurrentExpiringMap<std::string, int> listened(4);
+	std::atomic<size_t> evicted{0};
+	listened.set_eviction_listener([&listened, &evicted](std::vector<pj4dev::Eviction<std::string, int>>& batch) {
+		evicted += batch.size();
+		listened.detach();
+	});
+	listened.attach(reaper);
+	for (int i = 0; i < 1000; ++i) listened.put("key-" + std::to_string(i), i, 50);
+	usleep(300000);
+	std::cout << "<=== after a listener detached its map from the reaper\n";
+	std::cout << "listened size = " << listened.size() << ", evicted = " << (evicted > 0 ? "some" : "none") << std::endl;
+}
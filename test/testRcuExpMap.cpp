@@ -0,0 +1,78 @@
+//
+// @file: testRcuExpMap.cpp
+// @author: pj4dev.mit@gmail.com
+// @url: https://github.com/pj4dev/custom-cpp-libs
+
+#include "RcuExpiringMap.h"
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+
+typedef pj4dev::RcuExpiringMap<std::string, int> ExpMap;
+
+int main() {
+	ExpMap emap;
+	emap.put("hello", 1, 500);
+	emap.put("world", 2, 100);
+
+	// readers spin on get() while a writer keeps overwriting and growing the map
+	std::atomic<bool> done{false};
+	std::atomic<long> misses{0};
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 3; ++t) {
+		readers.emplace_back([&emap, &done, &misses]() {
+			while (!done) {
+				if (emap.get("hello") == 0) ++misses;
+			}
+		});
+	}
+	for (int i = 0; i < 20000; ++i) {
+		emap.put("hello", 1 + i % 7, 500);
+		emap.put("key-" + std::to_string(i), i, 300);
+	}
+	done = true;
+	for (auto& reader : readers) reader.join();
+	std::cout << "<=== after 20000 writes under 3 readers\n";
+	std::cout << "size = " << emap.size() << ", misses = " << misses << std::endl;
+
+	sleep(1);
+	std::cout << "<=== after sleep 1s\n";
+	std::cout << "size = " << emap.size() << std::endl;
+	std::cout << "hello = " << emap.get("hello") << "(left: " << emap.left("hello") << ")" << std::endl;
+
+	emap.put("world", 12, 40000);
+	emap.erase("hello");
+	std::cout << "<=== after new 'world' and delete 'hello'\n";
+	std::cout << "size = " << emap.size() << ", world = " << emap.get("world") << std::endl;
+	if (auto world = emap.lookup("world")) std::cout << "lookup world = " << *world << std::endl;
+
+	// more readers than reader slots: those without one nest their guards
+	// and write from inside them, as the others do
+	std::atomic<size_t> pinned{0};
+	std::atomic<bool> release{false};
+	std::vector<std::thread> holders;
+	for (size_t t = 0; t < pj4dev::EpochDomain::max_readers + 2; ++t) {
+		holders.emplace_back([&emap, &pinned, &release]() {
+			auto outer = emap.lookup("world");
+			auto inner = emap.lookup("world");
+			++pinned;
+			while (!release) std::this_thread::yield();
+		});
+	}
+	while (pinned < holders.size()) std::this_thread::yield();
+	std::thread([&emap]() {
+		auto world = emap.lookup("world");
+		emap.put("world", *world + 1, 40000);
+		std::cout << "<=== after a write nested in a read, past " << pj4dev::EpochDomain::max_readers << " readers\n";
+		std::cout << "world = " << emap.get("world") << std::endl;
+	}).join();
+	release = true;
+	for (auto& holder : holders) holder.join();
+
+	emap.clear();
+	std::cout << "<=== after clear()\n";
+	std::cout << "size = " << emap.size() << std::endl;
+}